@@ -0,0 +1,419 @@
+// Extraction throughput benchmark
+// Generates synthetic packages of different shapes, as block-split tar.xz (the way SpplicePack writes
+// them) and as tar.zst, extracts each of them with ToolsExtract in a child process, and prints one
+// JSON object per run to stdout.
+
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+
+#include <archive.h>
+#include <archive_entry.h>
+
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../globals.h" // Project globals
+#include "../tools/extract.h" // ToolsExtract
+#include "../packer/xzencoder.h" // xzEncoderOpen
+
+// Deterministic pseudo-random generator, so that every corpus is the same across machines
+struct benchRandom {
+  uint64_t state;
+  benchRandom (uint64_t seed) : state(seed ? seed : 0x9E3779B97F4A7C15ull) {}
+  uint64_t next () {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+  }
+  // Returns a number in the range [min, max]
+  uint64_t range (uint64_t min, uint64_t max) {
+    return min + next() % (max - min + 1);
+  }
+};
+
+// Writes a synthetic package archive, keeping track of what went into it
+// xz archives are split into blocks of the given size like SpplicePack does, so that they decode on every core
+class benchCorpusWriter {
+  public:
+
+    size_t files = 0;
+    size_t bytes = 0;
+
+    benchCorpusWriter (const std::filesystem::path path, const std::string &format, uint64_t blockSize, uint64_t seed) : random(seed) {
+      archive = archive_write_new();
+      archive_write_set_format_pax_restricted(archive);
+
+      if (format == "zstd") {
+        archive_write_add_filter_zstd(archive);
+        ok = archive_write_open_filename(archive, path.c_str()) == ARCHIVE_OK;
+      } else {
+        ok = xzEncoderOpen(archive, encoder, path, std::max(1u, std::thread::hardware_concurrency()), blockSize, 6);
+      }
+
+      if (!ok) std::cerr << "Failed to create " << path << ": " << archive_error_string(archive) << std::endl;
+    }
+
+    ~benchCorpusWriter () {
+      archive_write_free(archive);
+    }
+
+    bool close () {
+      if (archive_write_close(archive) != ARCHIVE_OK) ok = false;
+      return ok;
+    }
+
+    void addDirectory (const std::string &name) {
+      if (!ok) return;
+      struct archive_entry *entry = archive_entry_new();
+      archive_entry_set_pathname(entry, name.c_str());
+      archive_entry_set_filetype(entry, AE_IFDIR);
+      archive_entry_set_perm(entry, 0755);
+      archive_entry_set_mtime(entry, 1700000000, 0);
+      if (archive_write_header(archive, entry) != ARCHIVE_OK) ok = false;
+      archive_entry_free(entry);
+    }
+
+    // Text files look like VScript source, binary files look like half-compressible game assets
+    void addFile (const std::string &name, size_t size, bool text) {
+      if (!ok) return;
+
+      struct archive_entry *entry = archive_entry_new();
+      archive_entry_set_pathname(entry, name.c_str());
+      archive_entry_set_filetype(entry, AE_IFREG);
+      archive_entry_set_perm(entry, 0644);
+      archive_entry_set_size(entry, size);
+      archive_entry_set_mtime(entry, 1700000000, 0);
+      if (archive_write_header(archive, entry) != ARCHIVE_OK) ok = false;
+      archive_entry_free(entry);
+
+      size_t remaining = size;
+      while (ok && remaining > 0) {
+        const size_t chunkSize = std::min<size_t>(remaining, sizeof(chunk));
+        if (text) fillText(chunkSize);
+        else fillBinary(chunkSize);
+        if (archive_write_data(archive, chunk, chunkSize) != (la_ssize_t)chunkSize) ok = false;
+        remaining -= chunkSize;
+      }
+
+      files ++;
+      bytes += size;
+    }
+
+    benchRandom random;
+
+  private:
+
+    xzEncoderState encoder;
+    struct archive *archive;
+    bool ok;
+    char chunk[64 * 1024];
+
+    void fillText (size_t size) {
+      static const char *tokens[] = {
+        "function ", "local ", "return ", "if (", ") {\n", "}\n", "  ", "\n",
+        "EntFire(\"", "\", \"Trigger\", \"\", 0.0, null);\n", "printl(", "::", " = ", "null",
+        "player", "portal", "GetOrigin()", "SetAngles(", "Vector(", ", ", "0.0", "1.0",
+        "// ", "Entities.FindByClassname(", "\"prop_portal\"", "self", "foreach (", " in ", "true", "false"
+      };
+      const size_t tokenCount = sizeof(tokens) / sizeof(*tokens);
+
+      size_t offset = 0;
+      while (offset < size) {
+        const char *token = tokens[random.next() % tokenCount];
+        const size_t length = std::min(strlen(token), size - offset);
+        memcpy(chunk + offset, token, length);
+        offset += length;
+      }
+    }
+
+    void fillBinary (size_t size) {
+      // Alternates between noise and repeats of earlier data, which compresses roughly 2:1
+      size_t offset = 0;
+      while (offset < size) {
+        const size_t run = std::min<size_t>(random.range(64, 4096), size - offset);
+        if (offset >= 4096 && random.next() % 2) {
+          const size_t from = random.range(0, offset - run);
+          memmove(chunk + offset, chunk + from, run);
+        } else {
+          for (size_t i = 0; i < run; i ++) chunk[offset + i] = random.next() >> 56;
+        }
+        offset += run;
+      }
+    }
+
+};
+
+// Describes one synthetic package shape
+struct benchCorpus {
+  std::string name;
+  std::function<void (benchCorpusWriter &writer, double scale)> build;
+};
+
+static size_t scaled (size_t count, double scale) {
+  const size_t result = count * scale;
+  return result > 0 ? result : 1;
+}
+
+static const std::vector<benchCorpus> benchCorpora = {
+
+  // Lots of small files spread across a flat-ish tree
+  { "tiny", [](benchCorpusWriter &writer, double scale) {
+    const size_t directories = 100;
+    for (size_t i = 0; i < directories; i ++) writer.addDirectory("dir" + std::to_string(i));
+    const size_t files = scaled(20000, scale);
+    for (size_t i = 0; i < files; i ++) {
+      const std::string name = "dir" + std::to_string(i % directories) + "/file" + std::to_string(i);
+      writer.addFile(name + (i % 2 ? ".nut" : ".vmt"), writer.random.range(64, 4096), i % 2);
+    }
+  }},
+
+  // A few very large binary files
+  { "huge", [](benchCorpusWriter &writer, double scale) {
+    writer.addDirectory("maps");
+    for (size_t i = 0; i < 4; i ++) {
+      writer.addFile("maps/huge" + std::to_string(i) + ".bsp", scaled(64 << 20, scale), false);
+    }
+  }},
+
+  // Long chains of nested directories with a few files at every level
+  { "deep", [](benchCorpusWriter &writer, double scale) {
+    const size_t chains = scaled(16, scale);
+    for (size_t i = 0; i < chains; i ++) {
+      std::string path = "chain" + std::to_string(i);
+      for (size_t depth = 0; depth < 64; depth ++) {
+        writer.addDirectory(path);
+        for (size_t j = 0; j < 3; j ++) {
+          writer.addFile(path + "/file" + std::to_string(j) + ".txt", writer.random.range(1024, 16384), true);
+        }
+        path += "/level" + std::to_string(depth);
+      }
+    }
+  }},
+
+  // Resembles a typical mod: lots of scripts, some assets, a couple of maps
+  { "vscript", [](benchCorpusWriter &writer, double scale) {
+    const char *directories[] = { "scripts", "scripts/vscripts", "maps", "materials", "models", "sound", "cfg" };
+    for (const char *directory : directories) writer.addDirectory(directory);
+
+    for (size_t i = 0; i < scaled(1500, scale); i ++) {
+      writer.addFile("scripts/vscripts/script" + std::to_string(i) + ".nut", writer.random.range(1024, 48 << 10), true);
+    }
+    for (size_t i = 0; i < scaled(4, scale); i ++) {
+      writer.addFile("maps/map" + std::to_string(i) + ".bsp", writer.random.range(4 << 20, 16 << 20), false);
+    }
+    for (size_t i = 0; i < scaled(400, scale); i ++) {
+      writer.addFile("materials/texture" + std::to_string(i) + ".vtf", writer.random.range(8 << 10, 256 << 10), false);
+      writer.addFile("materials/texture" + std::to_string(i) + ".vmt", writer.random.range(128, 1024), true);
+    }
+    for (size_t i = 0; i < scaled(150, scale); i ++) {
+      writer.addFile("models/model" + std::to_string(i) + ".mdl", writer.random.range(4 << 10, 128 << 10), false);
+    }
+    for (size_t i = 0; i < scaled(120, scale); i ++) {
+      writer.addFile("sound/sound" + std::to_string(i) + ".wav", writer.random.range(32 << 10, 2 << 20), false);
+    }
+    for (size_t i = 0; i < 8; i ++) {
+      writer.addFile("cfg/config" + std::to_string(i) + ".cfg", writer.random.range(256, 4096), true);
+    }
+  }}
+
+};
+
+// Holds the totals of a generated corpus, stored next to the archive so that it can be reused
+struct benchCorpusInfo {
+  size_t files = 0;
+  size_t bytes = 0;
+  size_t archiveBytes = 0;
+};
+
+static bool prepareCorpus (const benchCorpus &corpus, const std::string &format, uint64_t blockSize, double scale, const std::filesystem::path workDir, std::filesystem::path &archivePath, benchCorpusInfo &info) {
+
+  // The block size is part of the name, as it changes the archive
+  std::ostringstream baseName;
+  baseName << corpus.name << "-x" << scale;
+  if (format == "zstd") {
+    archivePath = workDir / (baseName.str() + ".tar.zst");
+  } else {
+    baseName << "-b" << (blockSize >> 20);
+    archivePath = workDir / (baseName.str() + ".tar.xz");
+  }
+  const std::filesystem::path infoPath = workDir / (baseName.str() + ".info");
+
+  // Reuse a previously generated corpus if one exists
+  std::ifstream infoFile(infoPath);
+  if (infoFile.is_open() && infoFile >> info.files >> info.bytes && std::filesystem::exists(archivePath)) {
+    info.archiveBytes = std::filesystem::file_size(archivePath);
+    return true;
+  }
+  infoFile.close();
+
+  std::cerr << "Generating corpus \"" << corpus.name << "\" (" << format << ")..." << std::endl;
+
+  // Generation happens in a child process too, otherwise the encoder's memory would be inherited by
+  // every extraction child and show up in its peak RSS
+  const std::filesystem::path tmpPath = workDir / (baseName.str() + ".tmp" + archivePath.extension().string());
+  const pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) {
+    // Every format of a corpus holds the same files
+    benchCorpusWriter writer(tmpPath, format, blockSize, corpus.name.size());
+    corpus.build(writer, scale);
+    if (!writer.close()) _exit(1);
+    std::ofstream(infoPath) << writer.files << ' ' << writer.bytes << std::endl;
+    _exit(0);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return false;
+  std::filesystem::rename(tmpPath, archivePath);
+
+  infoFile.open(infoPath);
+  if (!(infoFile >> info.files >> info.bytes)) return false;
+  info.archiveBytes = std::filesystem::file_size(archivePath);
+  return true;
+
+}
+
+// Extracts the archive in a child process, so that its peak RSS can be measured on its own
+static bool runExtraction (const std::filesystem::path archivePath, const std::filesystem::path dest, double &seconds, long &peakRSS) {
+
+  const auto start = std::chrono::steady_clock::now();
+
+  const pid_t pid = fork();
+  if (pid < 0) return false;
+  if (pid == 0) _exit(ToolsExtract::extractLocalFile(archivePath, dest) ? 0 : 1);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid) return false;
+
+  seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  peakRSS = usage.ru_maxrss;
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+}
+
+static void printUsage (const char *name) {
+  std::cerr << "Usage: " << name << " [options]" << std::endl
+    << "  --corpus <name>   Only run the given corpus (tiny, huge, deep, vscript), can be repeated" << std::endl
+    << "  --format <name>   Only run the given archive format (xz, zstd), can be repeated" << std::endl
+    << "  --block-size <MiB> Uncompressed size of each xz block (default 8)" << std::endl
+    << "  --runs <n>        Number of extractions per corpus (default 3)" << std::endl
+    << "  --scale <f>       Multiplier for corpus file counts and sizes (default 1)" << std::endl
+    << "  --writers <n>     Number of extraction writer threads (default " << EXTRACT_WRITERS << ")" << std::endl
+    << "  --workdir <path>  Where corpora and extracted files are stored" << std::endl
+    << "  --log <path>      Write the extraction log to the given file" << std::endl;
+}
+
+int main (int argc, char *argv[]) {
+
+  std::vector<std::string> selected;
+  std::vector<std::string> formats;
+  uint64_t blockSize = 8 << 20;
+  int runs = 3;
+  double scale = 1.0;
+  std::filesystem::path workDir = std::filesystem::temp_directory_path() / "spplice-bench";
+
+  for (int i = 1; i < argc; i ++) {
+    const std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      printUsage(argv[0]);
+      return 1;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--corpus") selected.push_back(value);
+    else if (arg == "--format") formats.push_back(value);
+    else if (arg == "--block-size") blockSize = (uint64_t)std::max(1, std::atoi(value.c_str())) << 20;
+    else if (arg == "--runs") runs = std::max(1, std::atoi(value.c_str()));
+    else if (arg == "--scale") scale = std::atof(value.c_str());
+    else if (arg == "--writers") EXTRACT_WRITERS = std::max(0, std::atoi(value.c_str()));
+    else if (arg == "--workdir") workDir = value;
+    else if (arg == "--log") LOGFILE.open(value);
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (scale <= 0) {
+    std::cerr << "Scale must be positive" << std::endl;
+    return 1;
+  }
+  if (formats.empty()) formats = { "xz", "zstd" };
+  for (const std::string &format : formats) {
+    if (format == "xz" || format == "zstd") continue;
+    std::cerr << "Unknown format \"" << format << '"' << std::endl;
+    return 1;
+  }
+
+  std::filesystem::create_directories(workDir);
+  const std::filesystem::path extractDir = workDir / "extracted";
+
+  bool success = true;
+  for (const benchCorpus &corpus : benchCorpora) {
+
+    if (!selected.empty() && std::find(selected.begin(), selected.end(), corpus.name) == selected.end()) continue;
+
+    for (const std::string &format : formats) {
+
+      std::filesystem::path archivePath;
+      benchCorpusInfo info;
+      if (!prepareCorpus(corpus, format, blockSize, scale, workDir, archivePath, info)) {
+        std::cerr << "Failed to generate corpus \"" << corpus.name << "\" (" << format << ")" << std::endl;
+        success = false;
+        continue;
+      }
+
+      for (int run = 1; run <= runs; run ++) {
+
+        std::filesystem::remove_all(extractDir);
+        std::filesystem::create_directories(extractDir);
+
+        double seconds;
+        long peakRSS;
+        if (!runExtraction(archivePath, extractDir, seconds, peakRSS)) {
+          std::cerr << "Extraction of corpus \"" << corpus.name << "\" (" << format << ") failed" << std::endl;
+          success = false;
+          break;
+        }
+
+        std::cout << "{\"corpus\":\"" << corpus.name << '"'
+          << ",\"format\":\"" << format << '"'
+          << ",\"run\":" << run
+          << ",\"writers\":" << EXTRACT_WRITERS
+          << ",\"files\":" << info.files
+          << ",\"bytes\":" << info.bytes
+          << ",\"archive_bytes\":" << info.archiveBytes
+          << ",\"seconds\":" << seconds
+          << ",\"mb_per_s\":" << (info.bytes / 1e6) / seconds
+          << ",\"files_per_s\":" << info.files / seconds
+          << ",\"peak_rss_kb\":" << peakRSS
+          << '}' << std::endl;
+
+      }
+
+    }
+
+  }
+
+  std::filesystem::remove_all(extractDir);
+  return success ? 0 : 1;
+
+}
@@ -3,7 +3,6 @@
 #include <vector>
 
 #include "globals.h"
-#include "tools/package.h" // ToolsPackage
 
 // Points to the system-specific designated cache directory
 #ifndef TARGET_WINDOWS
@@ -12,6 +11,26 @@ std::filesystem::path CACHE_DIR = (std::filesystem::path(std::getenv("HOME")) /
 std::filesystem::path CACHE_DIR = std::filesystem::temp_directory_path() / "spplice-cpp";
 #endif
 bool CACHE_ENABLE = true;
+// Whether uncached packages should be extracted while they download
+bool STREAM_ENABLE = true;
+// Whether cached archives should be re-encoded for faster extraction while idle
+bool TRANSCODE_ENABLE = true;
+// Points to a memory-backed directory for staging package files (empty if disabled)
+std::filesystem::path STAGING_DIR;
+
+// Number of threads writing extracted files to disk (0 writes from the decoding thread)
+int EXTRACT_WRITERS = 4;
+// Maximum amount of decoded file data held in memory while waiting to be written
+size_t EXTRACT_BUFFER_SIZE = 64 << 20;
+// Maximum number of merge sources downloaded and extracted at once
+int MERGE_CONCURRENCY = 3;
+// Number of parallel connections used to download large package archives (below 2 disables segmenting)
+int DOWNLOAD_SEGMENTS = 4;
+// Cap on the combined download rate in bytes per second (0 means no cap)
+size_t DOWNLOAD_RATE_LIMIT = 0;
+// Disk space for prefetched archives that haven't been installed yet, and total bytes prefetched per session (0 disables prefetching)
+uintmax_t PREFETCH_DISK_BUDGET = 1024ull << 20;
+uintmax_t PREFETCH_BANDWIDTH_BUDGET = 2048ull << 20;
 
 // Points to the system-specific designated application directory
 #ifndef TARGET_WINDOWS
@@ -38,8 +57,6 @@ const std::string SPPLICE_VERSION_TAG = "v0.9.5-alpha";
 
 // Whether package merging should be allowed (false on startup)
 bool SPPLICE_MERGE_ENABLE = false;
-// Holds a list of packages to be used for merging
-std::vector<const ToolsPackage::PackageData*> SPPLICE_MERGE_SOURCES;
 
 // Contains a list of compatible Steam app names
 std::string SPPLICE_STEAMAPP_NAMES[] = {
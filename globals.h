@@ -3,15 +3,25 @@
 
 #include <filesystem>
 #include <fstream>
+#include <string>
 #include <vector>
-
-#include "tools/package.h" // ToolsPackage
+#include <cstdint>
 
 // Comment this line to target Linux, uncomment to target Windows
 #define TARGET_WINDOWS
 
 extern std::filesystem::path CACHE_DIR;
 extern bool CACHE_ENABLE;
+extern bool STREAM_ENABLE;
+extern bool TRANSCODE_ENABLE;
+extern std::filesystem::path STAGING_DIR;
+extern int EXTRACT_WRITERS;
+extern size_t EXTRACT_BUFFER_SIZE;
+extern int MERGE_CONCURRENCY;
+extern int DOWNLOAD_SEGMENTS;
+extern size_t DOWNLOAD_RATE_LIMIT;
+extern uintmax_t PREFETCH_DISK_BUDGET;
+extern uintmax_t PREFETCH_BANDWIDTH_BUDGET;
 extern const std::filesystem::path APP_DIR;
 extern std::filesystem::path GAME_DIR;
 extern std::ofstream LOGFILE;
@@ -21,7 +31,6 @@ extern int SPPLICE_NETCON_PORT;
 extern const std::string SPPLICE_VERSION_TAG;
 
 extern bool SPPLICE_MERGE_ENABLE;
-extern std::vector<const ToolsPackage::PackageData*> SPPLICE_MERGE_SOURCES;
 
 extern std::string SPPLICE_STEAMAPP_NAMES[];
 extern std::string SPPLICE_STEAMAPP_DIRS[];
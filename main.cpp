@@ -36,65 +36,110 @@
 #include "tools/curl.h"
 #include "tools/qt.h"
 #include "tools/install.h"
+#include "tools/mirror.h"
+#include "tools/store.h"
+#include "tools/basegame.h"
 #include "tools/package.h"
+#include "tools/progress.h"
 #include "tools/repo.h"
 #include "tools/update.h"
 
+// Remove all packages of the given repository URL from the list
+void hideRepository (const std::string &url, QVBoxLayout *container) {
+
+  for (int i = 0; i < container->count(); i ++) {
+    QWidget *child = container->itemAt(i)->widget();
+    if (child->property("packageRepository").toString().toStdString() == url) {
+      container->removeWidget(child);
+      delete child;
+      i --;
+    }
+  }
+
+}
+
+// Add the given packages to the list, above those of the repository with URL "last"
+void insertRepository (const std::vector<const ToolsPackage::PackageData*> &repository, const std::string &last, QVBoxLayout *container) {
+
+  // Convert last fetched repository url to QString for easier comparisons
+  QString lastQstr = QString::fromStdString(last);
+  // Keep track insertion point to order packages properly
+  int insertAt = 0;
+
+  // Move insertion point to the top of the most recently fetched repository
+  while (insertAt < container->count()) {
+    QWidget *widget = container->itemAt(insertAt)->widget();
+    if (widget->property("packageRepository").toString() == lastQstr) break;
+    insertAt ++;
+  }
+
+  for (const ToolsPackage::PackageData *package : repository) {
+    // Create PackageItem widget from PackageData
+    QWidget *item = ToolsPackage::createPackageItem(package);
+    // Add the item to the package list container
+    container->insertWidget(insertAt, item);
+    insertAt ++;
+    // Sleep for a few milliseconds on each package to reduce strain on the network
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+
+}
+
 // Fetch and display packages from the given repository URL asynchronously
+// The cached index is displayed first, then replaced only if the server has a newer one
 void displayRepository (const std::string &url, const std::string &last, QVBoxLayout *container) {
 
-  // Set up a watcher to fetch repository packages asynchronously
-  QFutureWatcher<std::vector<const ToolsPackage::PackageData*>> *watcher;
-  watcher = new QFutureWatcher<std::vector<const ToolsPackage::PackageData*>>(container);
+  // Set up a watcher to read the cached repository packages asynchronously
+  QFutureWatcher<std::vector<const ToolsPackage::PackageData*>> *cacheWatcher;
+  cacheWatcher = new QFutureWatcher<std::vector<const ToolsPackage::PackageData*>>(container);
 
-  // Connect a lambda that adds the items when they've been fetched
-  QObject::connect(watcher, &QFutureWatcher<std::vector<const ToolsPackage::PackageData*>>::finished, container, [container, watcher, last]() {
-    std::vector<const ToolsPackage::PackageData*> repository = watcher->result();
+  // Connect a lambda that adds the cached items, then revalidates them
+  QObject::connect(cacheWatcher, &QFutureWatcher<std::vector<const ToolsPackage::PackageData*>>::finished, container, [url, container, cacheWatcher, last]() {
+    const std::vector<const ToolsPackage::PackageData*> cached = cacheWatcher->result();
+    insertRepository(cached, last, container);
+    cacheWatcher->deleteLater();
 
-    // Convert last fetched repository url to QString for easier comparisons
-    QString lastQstr = QString::fromStdString(last);
-    // Keep track insertion point to order packages properly
-    int insertAt = 0;
+    // Set up a watcher to fetch repository packages asynchronously
+    QFutureWatcher<ToolsRepo::FetchResult> *watcher;
+    watcher = new QFutureWatcher<ToolsRepo::FetchResult>(container);
 
-    // Move insertion point to the top of the most recently fetched repository
-    while (insertAt < container->count()) {
-      QWidget *widget = container->itemAt(insertAt)->widget();
-      if (widget->property("packageRepository").toString() == lastQstr) break;
-      insertAt ++;
-    }
+    // Connect a lambda that replaces the items if the index has changed
+    QObject::connect(watcher, &QFutureWatcher<ToolsRepo::FetchResult>::finished, container, [url, container, watcher, last]() {
+      const ToolsRepo::FetchResult result = watcher->result();
 
-    for (const ToolsPackage::PackageData *package : repository) {
-      // Create PackageItem widget from PackageData
-      QWidget *item = ToolsPackage::createPackageItem(package);
-      // Add the item to the package list container
-      container->insertWidget(insertAt, item);
-      insertAt ++;
-      // Sleep for a few milliseconds on each package to reduce strain on the network
-      std::this_thread::sleep_for(std::chrono::milliseconds(5));
-    }
+      // A new index replaces the displayed one even if it lists nothing, otherwise keep what's there
+      if (result.status == ToolsRepo::FETCH_UPDATED) {
+        hideRepository(url, container);
+        insertRepository(result.repository, last, container);
+      }
+
+      watcher->deleteLater();
+    });
 
-    watcher->deleteLater();
+    // Fetch the repository packages in a new thread
+    QFuture<ToolsRepo::FetchResult> future = QtConcurrent::run([url, cached]() {
+      const ToolsRepo::FetchResult result = ToolsRepo::fetchRepository(url);
+      // Bring cached archives of packages that have since been updated up to date in the background
+      const std::vector<const ToolsPackage::PackageData*> &packages = result.status == ToolsRepo::FETCH_UPDATED ? result.repository : cached;
+      ToolsInstall::refreshCachedPackages(packages);
+      // Measure the hosts of mirrored packages ahead of time, so that installs don't wait on it
+      std::vector<std::string> sources;
+      for (const ToolsPackage::PackageData *package : packages) {
+        if (package->mirrors.empty()) continue;
+        sources.push_back(package->file);
+        sources.insert(sources.end(), package->mirrors.begin(), package->mirrors.end());
+      }
+      if (!sources.empty()) std::thread(ToolsMirror::probeHosts, sources).detach();
+      return result;
+    });
+    watcher->setFuture(future);
   });
 
-  // Fetch the repository packages in a new thread
+  // Read the cached repository packages in a new thread
   QFuture<std::vector<const ToolsPackage::PackageData*>> future = QtConcurrent::run([url]() {
-    return ToolsRepo::fetchRepository(url);
+    return ToolsRepo::loadCachedRepository(url);
   });
-  watcher->setFuture(future);
-
-}
-
-// Remove all packages of the given repository URL from the list
-void hideRepository (const std::string &url, QVBoxLayout *container) {
-
-  for (int i = 0; i < container->count(); i ++) {
-    QWidget *child = container->itemAt(i)->widget();
-    if (child->property("packageRepository").toString().toStdString() == url) {
-      container->removeWidget(child);
-      delete child;
-      i --;
-    }
-  }
+  cacheWatcher->setFuture(future);
 
 }
 
@@ -122,6 +167,114 @@ void checkCacheOverride (const std::filesystem::path &configPath) {
 
 }
 
+// Check for extraction tuning overrides: writer thread count, then buffer size in MiB
+void checkExtractOverride (const std::filesystem::path &configPath) {
+
+  if (!std::filesystem::exists(configPath)) return;
+
+  std::ifstream configFile(configPath);
+  if (!configFile.is_open()) {
+    std::cerr << "[E] Failed to open " << configPath << " for reading." << std::endl;
+    return;
+  }
+
+  int writers, bufferSize;
+  if (configFile >> writers && writers >= 0) EXTRACT_WRITERS = writers;
+  if (configFile >> bufferSize && bufferSize > 0) EXTRACT_BUFFER_SIZE = (size_t)bufferSize << 20;
+
+  LOGFILE << "[I] Extracting with " << EXTRACT_WRITERS << " writers and a " << (EXTRACT_BUFFER_SIZE >> 20) << " MiB buffer" << std::endl;
+
+}
+
+// Check if the number of merge sources prepared at once has been overridden
+void checkMergeOverride (const std::filesystem::path &configPath) {
+
+  if (!std::filesystem::exists(configPath)) return;
+
+  std::ifstream configFile(configPath);
+  if (!configFile.is_open()) {
+    std::cerr << "[E] Failed to open " << configPath << " for reading." << std::endl;
+    return;
+  }
+
+  int concurrency;
+  if (configFile >> concurrency && concurrency > 0) MERGE_CONCURRENCY = concurrency;
+
+  LOGFILE << "[I] Preparing up to " << MERGE_CONCURRENCY << " merge sources at once" << std::endl;
+
+}
+
+// Check for download tuning overrides: connections per package download, then a rate cap in KiB/s
+void checkDownloadOverride (const std::filesystem::path &configPath) {
+
+  if (!std::filesystem::exists(configPath)) return;
+
+  std::ifstream configFile(configPath);
+  if (!configFile.is_open()) {
+    std::cerr << "[E] Failed to open " << configPath << " for reading." << std::endl;
+    return;
+  }
+
+  int segments, rateLimit;
+  if (configFile >> segments && segments >= 0) DOWNLOAD_SEGMENTS = segments;
+  if (configFile >> rateLimit && rateLimit >= 0) DOWNLOAD_RATE_LIMIT = (size_t)rateLimit << 10;
+
+  LOGFILE << "[I] Downloading large packages over " << DOWNLOAD_SEGMENTS << " connections" << std::endl;
+  if (DOWNLOAD_RATE_LIMIT > 0) LOGFILE << "[I] Capping downloads at " << (DOWNLOAD_RATE_LIMIT >> 10) << " KiB/s" << std::endl;
+
+}
+
+// Check for prefetch budget overrides: disk space for prefetched archives, then bytes prefetched per session, both in MiB
+// Either being 0 disables prefetching
+void checkPrefetchOverride (const std::filesystem::path &configPath) {
+
+  if (!std::filesystem::exists(configPath)) return;
+
+  std::ifstream configFile(configPath);
+  if (!configFile.is_open()) {
+    std::cerr << "[E] Failed to open " << configPath << " for reading." << std::endl;
+    return;
+  }
+
+  long long diskBudget, bandwidthBudget;
+  if (configFile >> diskBudget && diskBudget >= 0) PREFETCH_DISK_BUDGET = (uintmax_t)diskBudget << 20;
+  if (configFile >> bandwidthBudget && bandwidthBudget >= 0) PREFETCH_BANDWIDTH_BUDGET = (uintmax_t)bandwidthBudget << 20;
+
+  LOGFILE << "[I] Prefetching up to " << (PREFETCH_DISK_BUDGET >> 20) << " MiB of packages, "
+    << (PREFETCH_BANDWIDTH_BUDGET >> 20) << " MiB per session" << std::endl;
+
+}
+
+// Check if package files should be staged in memory, and where
+// An empty config file picks the default location, which only exists on Linux
+void checkStagingOverride (const std::filesystem::path &configPath) {
+
+  if (!std::filesystem::exists(configPath)) return;
+
+  std::ifstream configFile(configPath);
+  if (!configFile.is_open()) {
+    std::cerr << "[E] Failed to open " << configPath << " for reading." << std::endl;
+    return;
+  }
+
+  std::string stagingDir;
+  std::getline(configFile, stagingDir);
+  configFile.close();
+
+#ifndef TARGET_WINDOWS
+  if (stagingDir.empty()) stagingDir = "/dev/shm";
+#endif
+
+  if (stagingDir.empty() || !std::filesystem::is_directory(stagingDir)) {
+    LOGFILE << "[E] Invalid staging directory \"" << stagingDir << "\", staging packages on disk" << std::endl;
+    return;
+  }
+
+  STAGING_DIR = std::filesystem::absolute(stagingDir);
+  LOGFILE << "[I] Staging packages in memory at " << STAGING_DIR << " when they fit" << std::endl;
+
+}
+
 // Log fatal crashes to file and perform cleanup
 void crashHandler (const std::string &error, uint code) {
   // Log the crash to file
@@ -171,6 +324,20 @@ int main (int argc, char *argv[]) {
   checkCacheOverride(APP_DIR / "cache_dir.txt");
   // Check if caching has been disabled
   CACHE_ENABLE = !std::filesystem::exists(APP_DIR / "disable_cache");
+  // Check if streamed extraction has been disabled
+  STREAM_ENABLE = !std::filesystem::exists(APP_DIR / "disable_streaming");
+  // Check if background transcoding of cached archives has been disabled
+  TRANSCODE_ENABLE = !std::filesystem::exists(APP_DIR / "disable_transcoding");
+  // Check for extraction tuning overrides in extract.txt
+  checkExtractOverride(APP_DIR / "extract.txt");
+  // Check for a memory-backed staging directory in ram_staging.txt
+  checkStagingOverride(APP_DIR / "ram_staging.txt");
+  // Check for a merge concurrency override in merge.txt
+  checkMergeOverride(APP_DIR / "merge.txt");
+  // Check for download tuning overrides in download.txt
+  checkDownloadOverride(APP_DIR / "download.txt");
+  // Check for prefetch budget overrides in prefetch.txt
+  checkPrefetchOverride(APP_DIR / "prefetch.txt");
 
   try { // Ensure CACHE_DIR exists
     std::filesystem::create_directories(CACHE_DIR);
@@ -198,6 +365,12 @@ int main (int argc, char *argv[]) {
   // Check for updates on a separate thread
   std::thread(ToolsUpdate::installUpdate).detach();
 
+  // Keep the cache in shape while idle, e.g. by re-encoding cached archives for faster extraction
+  std::thread(ToolsInstall::maintainCache).detach();
+
+  // Bring the index of base game files from the last session up to date before the first install needs it
+  ToolsBaseGame::startIndex();
+
   QPushButton *settingsButton = window.getSettingsButton();
   QPushButton *repositoryButton = window.getRepositoryButton();
   QVBoxLayout *packageContainer = window.getPackageListLayout();
@@ -265,10 +438,29 @@ int main (int argc, char *argv[]) {
     QPushButton *cacheToggle = dialogUI.CacheToggleBtn;
     cacheToggle->setText(CACHE_ENABLE ? "Disable cache" : "Enable cache");
 
+    // Show how much space the cache takes up below its description
+    QLabel *cacheText = dialogUI.CacheText;
+    const QString cacheDescription = cacheText->text();
+    auto updateCacheUsage = [cacheText, cacheDescription]() {
+      cacheText->setText(cacheDescription + "\n\nMeasuring the cache...");
+      // Walking the whole cache takes a while, so it's measured in a new thread
+      // The watcher belongs to the label, so a result arriving after the dialog has closed goes nowhere
+      auto *watcher = new QFutureWatcher<ToolsStore::CacheUsage>(cacheText);
+      QObject::connect(watcher, &QFutureWatcher<ToolsStore::CacheUsage>::finished, cacheText, [cacheText, cacheDescription, watcher]() {
+        const ToolsStore::CacheUsage usage = watcher->result();
+        const std::string usageText = "The cache currently takes up " + ToolsStore::formatSize(usage.physical) + " (" + ToolsStore::formatSize(usage.logical) + " before deduplication).";
+        cacheText->setText(cacheDescription + "\n\n" + QString::fromStdString(usageText));
+        watcher->deleteLater();
+      });
+      watcher->setFuture(QtConcurrent::run(ToolsStore::getCacheUsage));
+    };
+    updateCacheUsage();
+
     // Connect the "Clear cache" button
-    QObject::connect(dialogUI.CacheClearBtn, &QPushButton::clicked, []() {
+    QObject::connect(dialogUI.CacheClearBtn, &QPushButton::clicked, [updateCacheUsage]() {
       std::filesystem::remove_all(CACHE_DIR);
       std::filesystem::create_directories(CACHE_DIR);
+      updateCacheUsage();
       QMessageBox::information(nullptr, "Cache Cleared", "Cache has been cleared successfully.");
     });
 
@@ -353,8 +545,10 @@ int main (int argc, char *argv[]) {
       }
       SPPLICE_INSTALL_STATE = 1;
 
-      // Attempt to merge and install packages
+      // Attempt to merge and install packages, logging the time spent in each stage
+      ToolsProgress::begin("merge of " + std::to_string(SPPLICE_MERGE_SOURCES.size()) + " packages");
       const std::string mergeResult = ToolsInstall::installMergedPackage(SPPLICE_MERGE_SOURCES);
+      ToolsProgress::end();
 
       // Display any installation errors to the user
       if (mergeResult != "") {
@@ -427,6 +621,11 @@ int main (int argc, char *argv[]) {
   window.setWindowTitle("Spplice");
   window.show();
 
+  // Read the additional repositories, and start connecting to all repository hosts right away
+  std::vector<std::string> repositories = ToolsRepo::readFromFile();
+  ToolsCURL::preconnect(globalRepository);
+  for (const std::string &url : repositories) ToolsCURL::preconnect(url);
+
   // Load the global repository, putting it at the very bottom
   displayRepository(globalRepository, "", packageContainer);
 
@@ -434,7 +633,6 @@ int main (int argc, char *argv[]) {
   std::string lastRepository = globalRepository;
 
   // Load additional repositories from file
-  std::vector<std::string> repositories = ToolsRepo::readFromFile();
   for (int i = 0; i < repositories.size(); i ++) {
     displayRepository(repositories.at(i), lastRepository, packageContainer);
     lastRepository = repositories.at(i);
@@ -0,0 +1,425 @@
+// Spplice package builder
+// Packs a directory of package files into a .sppkg: a plain tar holding the manifest, the icon and
+// the package archive, in that order. The package archive is laid out for fast extraction: entries
+// are sorted for locality with small files first, and the xz stream is split into independent
+// blocks which Spplice decodes on multiple threads.
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+
+#ifdef TARGET_WINDOWS
+  #include "../deps/win32/include/archive.h"
+  #include "../deps/win32/include/archive_entry.h"
+  #include "../deps/win32/include/lzma.h"
+#else
+  #include <archive.h>
+  #include <archive_entry.h>
+  #include <lzma.h>
+#endif
+
+#include "xzencoder.h" // xzEncoderOpen
+
+// Files up to this size are written before all others
+#define PACK_SMALL_FILE_SIZE (64 << 10)
+
+// Holds the command line options of the packer
+struct packOptions {
+  std::filesystem::path input;
+  std::filesystem::path output;
+  std::filesystem::path icon;
+  std::string title;
+  std::string author;
+  std::string description;
+  std::string version = "1.0.0";
+  std::vector<std::string> args;
+  bool keepBaseFiles = false;
+  // xz preset level, and the amount of uncompressed data per xz block
+  uint32_t level = 6;
+  uint64_t blockSize = 8 << 20;
+  uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// Describes a file or directory going into the package archive
+struct packEntry {
+  std::filesystem::path path;
+  std::string name;
+  bool directory;
+  uintmax_t size;
+};
+
+// Returns the given string as a quoted JSON string
+std::string jsonString (const std::string &value) {
+
+  std::string output = "\"";
+  for (char c : value) {
+    switch (c) {
+      case '"': output += "\\\""; break;
+      case '\\': output += "\\\\"; break;
+      case '\n': output += "\\n"; break;
+      case '\r': output += "\\r"; break;
+      case '\t': output += "\\t"; break;
+      default:
+        if ((unsigned char)c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          output += escaped;
+        } else {
+          output += c;
+        }
+    }
+  }
+  return output + "\"";
+
+}
+
+// Builds the package manifest, pointing its icon at the given archive member
+std::string buildManifest (const packOptions &options, const std::string &iconName) {
+
+  std::string manifest = "{\n";
+  manifest += "  \"title\": " + jsonString(options.title) + ",\n";
+  manifest += "  \"author\": " + jsonString(options.author) + ",\n";
+  manifest += "  \"description\": " + jsonString(options.description) + ",\n";
+  manifest += "  \"version\": " + jsonString(options.version) + ",\n";
+  manifest += "  \"icon\": " + jsonString(iconName) + ",\n";
+  manifest += "  \"args\": [";
+  for (size_t i = 0; i < options.args.size(); i ++) {
+    manifest += (i == 0 ? "" : ", ") + jsonString(options.args[i]);
+  }
+  manifest += "]";
+  if (options.keepBaseFiles) manifest += ",\n  \"skip_base_files\": false";
+  manifest += "\n}\n";
+  return manifest;
+
+}
+
+// Lists the package files in the order they'll be archived in
+// Directories come first so that they exist before anything is written to them,
+// then small files like scripts and configs, then everything else, each grouped by directory
+bool collectEntries (const std::filesystem::path input, std::vector<packEntry> &entries) {
+
+  try {
+    for (const auto &file : std::filesystem::recursive_directory_iterator(input)) {
+      packEntry entry;
+      entry.path = file.path();
+      entry.name = file.path().lexically_relative(input).generic_string();
+      entry.directory = !file.is_symlink() && file.is_directory();
+      entry.size = (!file.is_symlink() && file.is_regular_file()) ? file.file_size() : 0;
+      entries.push_back(entry);
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    std::cerr << "Failed to list package files: " << e.what() << std::endl;
+    return false;
+  }
+
+  auto entryGroup = [](const packEntry &entry) {
+    if (entry.directory) return 0;
+    return entry.size <= PACK_SMALL_FILE_SIZE ? 1 : 2;
+  };
+
+  std::sort(entries.begin(), entries.end(), [&entryGroup](const packEntry &a, const packEntry &b) {
+    const int groupA = entryGroup(a), groupB = entryGroup(b);
+    if (groupA != groupB) return groupA < groupB;
+    const std::string parentA = std::filesystem::path(a.name).parent_path().generic_string();
+    const std::string parentB = std::filesystem::path(b.name).parent_path().generic_string();
+    if (parentA != parentB) return parentA < parentB;
+    return a.name < b.name;
+  });
+
+  return true;
+
+}
+
+// Writes the package files into a multi-block tar.xz archive
+bool writePackageArchive (const packOptions &options, const std::vector<packEntry> &entries, const std::filesystem::path dest) {
+
+  xzEncoderState state;
+  struct archive *archive = archive_write_new();
+  archive_write_set_format_pax_restricted(archive);
+  if (!xzEncoderOpen(archive, state, dest, options.threads, options.blockSize, options.level)) {
+    archive_write_free(archive);
+    return false;
+  }
+
+  // Entry metadata comes from the files on disk, minus anything specific to this machine
+  struct archive *disk = archive_read_disk_new();
+  archive_read_disk_set_symlink_physical(disk);
+
+  bool success = true;
+  std::vector<char> buffer(1 << 20);
+
+  for (const packEntry &packed : entries) {
+
+    struct archive_entry *entry = archive_entry_new();
+#ifndef TARGET_WINDOWS
+    archive_entry_copy_sourcepath(entry, packed.path.c_str());
+#else
+    archive_entry_copy_sourcepath_w(entry, packed.path.c_str());
+#endif
+    if (archive_read_disk_entry_from_file(disk, entry, -1, nullptr) != ARCHIVE_OK) {
+      std::cerr << "Failed to read " << packed.path << ": " << archive_error_string(disk) << std::endl;
+      archive_entry_free(entry);
+      success = false;
+      break;
+    }
+    archive_entry_set_pathname(entry, packed.name.c_str());
+    archive_entry_set_uid(entry, 0);
+    archive_entry_set_gid(entry, 0);
+    archive_entry_set_uname(entry, "");
+    archive_entry_set_gname(entry, "");
+
+    if (archive_write_header(archive, entry) != ARCHIVE_OK) {
+      std::cerr << "Failed to write " << packed.name << ": " << archive_error_string(archive) << std::endl;
+      archive_entry_free(entry);
+      success = false;
+      break;
+    }
+    archive_entry_free(entry);
+
+    if (packed.directory || packed.size == 0) continue;
+
+    std::ifstream file(packed.path, std::ios::binary);
+    while (file) {
+      file.read(buffer.data(), buffer.size());
+      if (file.gcount() == 0) break;
+      if (archive_write_data(archive, buffer.data(), file.gcount()) != file.gcount()) {
+        std::cerr << "Failed to write " << packed.name << ": " << archive_error_string(archive) << std::endl;
+        success = false;
+        break;
+      }
+    }
+    if (!success) break;
+
+  }
+
+  archive_read_free(disk);
+  if (archive_write_close(archive) != ARCHIVE_OK) success = false;
+  archive_write_free(archive);
+
+  return success;
+
+}
+
+// Writes a file held in memory or on disk as a member of the outer package
+bool writeMember (struct archive *archive, const std::string &name, const std::string *contents, const std::filesystem::path path) {
+
+  const uintmax_t size = contents ? contents->size() : std::filesystem::file_size(path);
+
+  struct archive_entry *entry = archive_entry_new();
+  archive_entry_set_pathname(entry, name.c_str());
+  archive_entry_set_filetype(entry, AE_IFREG);
+  archive_entry_set_perm(entry, 0644);
+  archive_entry_set_size(entry, size);
+  archive_entry_set_mtime(entry, std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()), 0);
+
+  const bool headerWritten = archive_write_header(archive, entry) == ARCHIVE_OK;
+  archive_entry_free(entry);
+  if (!headerWritten) {
+    std::cerr << "Failed to write " << name << ": " << archive_error_string(archive) << std::endl;
+    return false;
+  }
+
+  if (contents) {
+    return archive_write_data(archive, contents->data(), contents->size()) == (la_ssize_t)contents->size();
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> buffer(1 << 20);
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    if (file.gcount() == 0) break;
+    if (archive_write_data(archive, buffer.data(), file.gcount()) != file.gcount()) return false;
+  }
+  return true;
+
+}
+
+// Decodes the package archive the way Spplice would, returns the time taken in seconds or -1 on failure
+double measureDecodeTime (const std::filesystem::path path, uint32_t threads, uint64_t &blocks) {
+
+  std::ifstream file(path, std::ios::binary);
+  std::vector<uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::vector<uint8_t> output(1 << 20);
+
+  // Read the block count from the index at the end of the stream
+  blocks = 0;
+  lzma_stream_flags footerFlags;
+  if (input.size() >= 2 * LZMA_STREAM_HEADER_SIZE && lzma_stream_footer_decode(&footerFlags, input.data() + input.size() - LZMA_STREAM_HEADER_SIZE) == LZMA_OK) {
+    lzma_index *index = nullptr;
+    uint64_t memlimit = UINT64_MAX;
+    size_t position = 0;
+    const uint8_t *indexStart = input.data() + input.size() - LZMA_STREAM_HEADER_SIZE - footerFlags.backward_size;
+    if (lzma_index_buffer_decode(&index, &memlimit, nullptr, indexStart, &position, footerFlags.backward_size) == LZMA_OK) {
+      blocks = lzma_index_block_count(index);
+      lzma_index_end(index, nullptr);
+    }
+  }
+
+  lzma_mt options = {};
+  options.threads = threads;
+  options.memlimit_threading = UINT64_MAX;
+  options.memlimit_stop = UINT64_MAX;
+
+  lzma_stream stream = LZMA_STREAM_INIT;
+  if (lzma_stream_decoder_mt(&stream, &options) != LZMA_OK) return -1;
+
+  const auto start = std::chrono::steady_clock::now();
+
+  stream.next_in = input.data();
+  stream.avail_in = input.size();
+  lzma_ret result;
+  do {
+    stream.next_out = output.data();
+    stream.avail_out = output.size();
+    result = lzma_code(&stream, LZMA_FINISH);
+  } while (result == LZMA_OK);
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  lzma_end(&stream);
+
+  return result == LZMA_STREAM_END ? seconds : -1;
+
+}
+
+void printUsage (const char *name) {
+  std::cerr << "Usage: " << name << " <package directory> -o <output.sppkg> [options]" << std::endl
+    << "  --title <text>        Package title" << std::endl
+    << "  --author <text>       Package author" << std::endl
+    << "  --description <text>  Package description, newlines are kept" << std::endl
+    << "  --version <text>      Package version (default 1.0.0)" << std::endl
+    << "  --arg <text>          Game launch argument, can be repeated" << std::endl
+    << "  --icon <path>         Package icon image" << std::endl
+    << "  --keep-base-files     Install files even if they're identical to the base game's" << std::endl
+    << "  --level <0-9>         xz compression level (default 6)" << std::endl
+    << "  --block-size <MiB>    Uncompressed size of each xz block (default 8)" << std::endl
+    << "  --threads <n>         Compression threads (default: all cores)" << std::endl;
+}
+
+int main (int argc, char *argv[]) {
+
+  packOptions options;
+
+  for (int i = 1; i < argc; i ++) {
+    const std::string arg = argv[i];
+    if (arg == "--help" || arg == "-h") {
+      printUsage(argv[0]);
+      return 0;
+    }
+    if (arg == "--keep-base-files") {
+      options.keepBaseFiles = true;
+      continue;
+    }
+    if (arg.rfind("-", 0) != 0) {
+      options.input = arg;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      printUsage(argv[0]);
+      return 1;
+    }
+    const std::string value = argv[++i];
+    if (arg == "-o" || arg == "--output") options.output = value;
+    else if (arg == "--title") options.title = value;
+    else if (arg == "--author") options.author = value;
+    else if (arg == "--description") options.description = value;
+    else if (arg == "--version") options.version = value;
+    else if (arg == "--arg") options.args.push_back(value);
+    else if (arg == "--icon") options.icon = value;
+    else if (arg == "--level") options.level = std::min(9, std::max(0, std::atoi(value.c_str())));
+    else if (arg == "--block-size") options.blockSize = (uint64_t)std::max(1, std::atoi(value.c_str())) << 20;
+    else if (arg == "--threads") options.threads = std::max(1, std::atoi(value.c_str()));
+    else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.input.empty() || options.output.empty()) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  if (!std::filesystem::is_directory(options.input)) {
+    std::cerr << options.input << " is not a directory" << std::endl;
+    return 1;
+  }
+  if (!options.icon.empty() && !std::filesystem::is_regular_file(options.icon)) {
+    std::cerr << "Icon " << options.icon << " does not exist" << std::endl;
+    return 1;
+  }
+  if (options.title.empty()) options.title = options.input.filename().string();
+
+  // Build the package archive next to the output first, it gets copied into the .sppkg afterwards
+  std::vector<packEntry> entries;
+  if (!collectEntries(options.input, entries)) return 1;
+
+  uintmax_t totalSize = 0;
+  size_t fileCount = 0;
+  for (const packEntry &entry : entries) {
+    totalSize += entry.size;
+    if (!entry.directory) fileCount ++;
+  }
+
+  std::filesystem::path archivePath = options.output;
+  archivePath += ".tar.xz.tmp";
+
+  std::cout << "Compressing " << fileCount << " files (" << (totalSize >> 10) << " KiB) in "
+    << (options.blockSize >> 20) << " MiB blocks on " << options.threads << " threads..." << std::endl;
+  if (!writePackageArchive(options, entries, archivePath)) {
+    std::filesystem::remove(archivePath);
+    return 1;
+  }
+
+  // Assemble the .sppkg, manifest and icon first so that they can be read without going through the archive
+  const std::string iconName = options.icon.empty() ? "" : "icon" + options.icon.extension().string();
+  const std::string manifest = buildManifest(options, iconName);
+
+  struct archive *package = archive_write_new();
+  archive_write_set_format_pax_restricted(package);
+  archive_write_add_filter_none(package);
+
+  bool success = archive_write_open_filename(package, options.output.string().c_str()) == ARCHIVE_OK;
+  if (!success) std::cerr << "Failed to create " << options.output << ": " << archive_error_string(package) << std::endl;
+  if (success) success = writeMember(package, "manifest.json", &manifest, std::filesystem::path());
+  if (success && !options.icon.empty()) success = writeMember(package, iconName, nullptr, options.icon);
+  if (success) success = writeMember(package, "package.tar.xz", nullptr, archivePath);
+  if (archive_write_close(package) != ARCHIVE_OK) success = false;
+  archive_write_free(package);
+
+  if (!success) {
+    std::cerr << "Failed to write " << options.output << std::endl;
+    std::filesystem::remove(archivePath);
+    std::filesystem::remove(options.output);
+    return 1;
+  }
+
+  // Report how quickly the package decodes, both on this machine's cores and on a single one
+  const uintmax_t archiveSize = std::filesystem::file_size(archivePath);
+  const uint32_t decodeThreads = std::max(1u, std::thread::hardware_concurrency());
+  uint64_t blocks;
+  const double decodeTime = measureDecodeTime(archivePath, decodeThreads, blocks);
+  const double singleDecodeTime = decodeThreads > 1 ? measureDecodeTime(archivePath, 1, blocks) : decodeTime;
+  std::filesystem::remove(archivePath);
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Wrote " << options.output << std::endl
+    << "  Package archive: " << (archiveSize >> 10) << " KiB (" << (totalSize ? 100.0 * archiveSize / totalSize : 0) << "% of "
+    << (totalSize >> 10) << " KiB) in " << blocks << " xz blocks" << std::endl;
+
+  if (decodeTime < 0 || singleDecodeTime < 0) {
+    std::cerr << "Failed to decode the package archive" << std::endl;
+    return 1;
+  }
+  std::cout << "  Estimated decode time: " << singleDecodeTime << "s on one thread";
+  if (decodeThreads > 1) std::cout << ", " << decodeTime << "s on " << decodeThreads << " threads";
+  std::cout << std::endl;
+
+  return 0;
+
+}
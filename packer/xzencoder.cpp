@@ -0,0 +1,79 @@
+// Writes tar archives as xz streams split into independent blocks, which Spplice decodes on multiple threads
+// Shared by the package builder and the extraction benchmark, so that both produce the same layout
+
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+
+// Definitions for this source file
+#include "xzencoder.h"
+
+// Runs the encoder on the given input, writing out whatever it produces
+bool xzEncode (xzEncoderState &state, const uint8_t *data, size_t size, lzma_action action) {
+
+  lzma_stream &stream = state.stream;
+  stream.next_in = data;
+  stream.avail_in = size;
+
+  while (true) {
+    stream.next_out = state.outBuffer.data();
+    stream.avail_out = state.outBuffer.size();
+
+    const lzma_ret result = lzma_code(&stream, action);
+    state.file.write(reinterpret_cast<const char*>(state.outBuffer.data()), state.outBuffer.size() - stream.avail_out);
+    if (!state.file) return false;
+
+    if (result == LZMA_STREAM_END) return true;
+    if (result != LZMA_OK) {
+      std::cerr << "xz encoder error " << result << std::endl;
+      return false;
+    }
+    if (action == LZMA_RUN && stream.avail_in == 0) return true;
+  }
+
+}
+
+// libarchive write callback, compresses the tar stream
+la_ssize_t xzEncoderWrite (struct archive *, void *data, const void *buffer, size_t length) {
+  xzEncoderState *state = static_cast<xzEncoderState*>(data);
+  if (!xzEncode(*state, static_cast<const uint8_t*>(buffer), length, LZMA_RUN)) return -1;
+  return length;
+}
+
+// libarchive close callback, flushes the last xz block and the index
+int xzEncoderClose (struct archive *, void *data) {
+  xzEncoderState *state = static_cast<xzEncoderState*>(data);
+  if (!xzEncode(*state, nullptr, 0, LZMA_FINISH)) return ARCHIVE_FATAL;
+  state->file.close();
+  return ARCHIVE_OK;
+}
+
+// Opens the given new archive for writing to a file through the xz encoder, starting a new block every `blockSize` bytes
+// The encoder state has to outlive the archive, returns false (having reported why) if anything failed
+bool xzEncoderOpen (struct archive *archive, xzEncoderState &state, const std::filesystem::path path, uint32_t threads, uint64_t blockSize, uint32_t preset) {
+
+  state.file.open(path, std::ios::binary);
+  if (!state.file.is_open()) {
+    std::cerr << "Failed to open " << path << " for writing" << std::endl;
+    return false;
+  }
+
+  lzma_mt encoderOptions = {};
+  encoderOptions.threads = threads;
+  encoderOptions.block_size = blockSize;
+  encoderOptions.preset = preset;
+  encoderOptions.check = LZMA_CHECK_CRC64;
+  if (lzma_stream_encoder_mt(&state.stream, &encoderOptions) != LZMA_OK) {
+    std::cerr << "Failed to initialize xz encoder" << std::endl;
+    return false;
+  }
+
+  archive_write_add_filter_none(archive);
+  if (archive_write_open(archive, &state, nullptr, xzEncoderWrite, xzEncoderClose) != ARCHIVE_OK) {
+    std::cerr << "Failed to create " << path << ": " << archive_error_string(archive) << std::endl;
+    return false;
+  }
+
+  return true;
+
+}
@@ -0,0 +1,28 @@
+#ifndef PACKER_XZENCODER_H
+#define PACKER_XZENCODER_H
+
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+
+#ifdef TARGET_WINDOWS
+  #include "../deps/win32/include/archive.h"
+  #include "../deps/win32/include/lzma.h"
+#else
+  #include <archive.h>
+  #include <lzma.h>
+#endif
+
+// Holds the state of the multi-threaded xz encoder which an archive is written through
+struct xzEncoderState {
+  std::ofstream file;
+  lzma_stream stream = LZMA_STREAM_INIT;
+  std::vector<uint8_t> outBuffer = std::vector<uint8_t>(1 << 20);
+
+  ~xzEncoderState () { lzma_end(&this->stream); }
+};
+
+bool xzEncoderOpen (struct archive *archive, xzEncoderState &state, const std::filesystem::path path, uint32_t threads, uint64_t blockSize, uint32_t preset);
+
+#endif
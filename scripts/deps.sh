@@ -40,10 +40,11 @@ mkdir shared
     mkdir include
 
     mkdir xz; cd xz
-      wget https://tukaani.org/xz/xz-5.2.9-windows.zip
-      unzip xz-5.2.9-windows.zip
+      wget https://github.com/tukaani-project/xz/releases/download/v5.4.6/xz-5.4.6-windows.zip
+      unzip xz-5.4.6-windows.zip
       mv ./bin_x86-64/*.exe ../bin
       mv ./bin_x86-64/* ../lib
+      mv ./include/* ../include
     cd ..; rm -rf xz
 
     mkdir archive; cd archive
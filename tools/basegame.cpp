@@ -0,0 +1,508 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cctype>
+#include <cstdint>
+
+#include "../globals.h" // Project globals
+#include "extract.h" // ToolsExtract
+
+#ifdef TARGET_WINDOWS
+  #include "../deps/win32/include/lzma.h"
+#else
+  #include <lzma.h>
+#endif
+
+// Definitions for this source file
+#include "basegame.h"
+
+// A file of the base game, as found first through the game's search paths
+struct baseGameFile {
+  std::string directory;
+  uintmax_t size;
+  int64_t mtime;
+  uint64_t crc;
+  bool hashed;
+};
+
+// Guards all of the base game index state below
+std::mutex baseGameMutex;
+// Whether the index has been read from disk yet, and whether it has changed since it was last written
+bool baseGameLoaded = false;
+bool baseGameDirty = false;
+// The game and mod directories which the index was built from
+std::filesystem::path baseGameDir;
+std::string baseGameAppDir;
+// Loose base game files by their path relative to the search path
+std::unordered_map<std::string, baseGameFile> baseGameFiles;
+// Lowercase paths of files packed in VPKs, which the engine picks over any loose file
+std::unordered_set<std::string> baseGamePacked;
+// Whether the index has been rebuilt this session, whether that's happening right now,
+// and the directories to index next (empty if there's no request waiting), see ToolsBaseGame::startIndex
+bool baseGameFresh = false;
+bool baseGameIndexing = false;
+std::filesystem::path baseGameRequestedDir;
+std::string baseGameRequestedAppDir;
+
+// Returns the path of the base game index file
+std::filesystem::path getBaseGameIndexPath () {
+  return CACHE_DIR / "basegame.idx";
+}
+
+// Returns the given string in lowercase
+std::string toLowercase (std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+  return value;
+}
+
+// Returns the game's search path directories, from highest to lowest priority
+std::vector<std::string> getSearchDirectories (const std::filesystem::path gameDir, const std::string appDir) {
+
+  // DLC directories are searched from the highest numbered one down
+  std::vector<std::pair<int, std::string>> dlcDirectories;
+  const std::string dlcPrefix = appDir + "_dlc";
+
+  std::error_code error;
+  for (const auto &entry : std::filesystem::directory_iterator(gameDir, error)) {
+    const std::string name = entry.path().filename().string();
+    if (!entry.is_directory() || name.rfind(dlcPrefix, 0) != 0) continue;
+    dlcDirectories.push_back({ std::atoi(name.substr(dlcPrefix.size()).c_str()), name });
+  }
+  std::sort(dlcDirectories.rbegin(), dlcDirectories.rend());
+
+  std::vector<std::string> directories = { "update" };
+  for (const auto &dlc : dlcDirectories) directories.push_back(dlc.second);
+  directories.push_back(appDir);
+
+  return directories;
+
+}
+
+// Adds the lowercase paths of all files in a VPK directory file to the given set
+bool readVPKNames (const std::filesystem::path path, std::unordered_set<std::string> &names) {
+
+  std::ifstream file(path, std::ios::binary);
+  uint32_t header[3];
+  if (!file.read(reinterpret_cast<char*>(header), sizeof(header))) return false;
+  if (header[0] != 0x55AA1234 || (header[1] != 1 && header[1] != 2)) return false;
+
+  // Version 2 has four more header fields describing sections which come after the tree
+  if (header[1] == 2) file.seekg(16, std::ios::cur);
+
+  std::vector<char> tree(header[2]);
+  if (!file.read(tree.data(), tree.size())) return false;
+
+  size_t position = 0;
+  auto readString = [&tree, &position](std::string &output) {
+    const size_t end = std::find(tree.begin() + position, tree.end(), '\0') - tree.begin();
+    if (end >= tree.size()) return false;
+    output.assign(tree.data() + position, end - position);
+    position = end + 1;
+    return true;
+  };
+
+  // The tree is grouped by extension, then by directory, with a " " standing in for an empty string
+  std::string extension, directory, name;
+  while (readString(extension) && !extension.empty()) {
+    while (readString(directory) && !directory.empty()) {
+      while (readString(name) && !name.empty()) {
+
+        // CRC32, preload size, archive index, offset, length, terminator
+        if (position + 18 > tree.size()) return false;
+        const uint16_t preloadSize = static_cast<uint8_t>(tree[position + 4]) | (static_cast<uint8_t>(tree[position + 5]) << 8);
+        position += 18 + preloadSize;
+
+        std::string fullName = directory == " " ? "" : directory + "/";
+        fullName += name;
+        if (extension != " ") fullName += "." + extension;
+        names.insert(toLowercase(fullName));
+
+      }
+    }
+  }
+
+  return true;
+
+}
+
+// Reads the index from disk if that hasn't been done yet, the index mutex has to be held
+void loadBaseGameIndex () {
+
+  if (baseGameLoaded) return;
+  baseGameLoaded = true;
+
+  std::ifstream file(getBaseGameIndexPath());
+  std::string line;
+  if (!std::getline(file, line) || line != "spplice-basegame-1") return;
+
+  std::string gameDir, appDir;
+  if (!std::getline(file, gameDir) || !std::getline(file, appDir)) return;
+  baseGameDir = std::filesystem::u8path(gameDir);
+  baseGameAppDir = appDir;
+
+  while (std::getline(file, line)) {
+
+    std::istringstream fields(line);
+    std::string type;
+    std::getline(fields, type, '\t');
+
+    if (type == "P") {
+      std::string name;
+      std::getline(fields, name);
+      baseGamePacked.insert(name);
+      continue;
+    }
+    if (type != "F") continue;
+
+    baseGameFile entry;
+    std::string crc, name;
+    fields >> entry.size >> entry.mtime >> crc;
+    fields.ignore(1);
+    std::getline(fields, entry.directory, '\t');
+    std::getline(fields, name);
+    if (fields.fail()) continue;
+
+    entry.hashed = crc != "-";
+    entry.crc = entry.hashed ? std::stoull(crc, nullptr, 16) : 0;
+    baseGameFiles[name] = entry;
+
+  }
+
+}
+
+// Writes the index to disk if it has changed
+void ToolsBaseGame::saveIndex () {
+
+  std::lock_guard<std::mutex> lock(baseGameMutex);
+  if (!baseGameDirty) return;
+
+  const std::filesystem::path indexPath = getBaseGameIndexPath();
+  std::filesystem::path tempPath = indexPath;
+  tempPath += ".tmp";
+
+  std::ofstream file(tempPath);
+  if (!file.is_open()) {
+    LOGFILE << "[W] Couldn't open " << tempPath << " for writing" << std::endl;
+    return;
+  }
+
+  file << "spplice-basegame-1\n" << baseGameDir.u8string() << '\n' << baseGameAppDir << '\n';
+  for (const auto &indexed : baseGameFiles) {
+    const baseGameFile &entry = indexed.second;
+    file << "F\t" << entry.size << '\t' << entry.mtime << '\t';
+    if (entry.hashed) file << std::hex << entry.crc << std::dec;
+    else file << '-';
+    file << '\t' << entry.directory << '\t' << indexed.first << '\n';
+  }
+  for (const std::string &name : baseGamePacked) file << "P\t" << name << '\n';
+  file.close();
+
+  std::error_code error;
+  std::filesystem::rename(tempPath, indexPath, error);
+  if (error) {
+    LOGFILE << "[W] Failed to write base game index: " << error.message() << std::endl;
+    return;
+  }
+  baseGameDirty = false;
+
+}
+
+// Rebuilds the index of the given game's files, keeping checksums of files which haven't changed
+// Meant to run on a background thread once the game has been located
+void ToolsBaseGame::updateIndex (const std::filesystem::path gameDir, const std::string appDir) {
+
+  const auto start = std::chrono::steady_clock::now();
+
+  // Checksums from the previous index can be reused if it was built from the same directories
+  std::unordered_map<std::string, baseGameFile> previousFiles;
+  {
+    std::lock_guard<std::mutex> lock(baseGameMutex);
+    loadBaseGameIndex();
+    if (baseGameDir == gameDir && baseGameAppDir == appDir) previousFiles = baseGameFiles;
+  }
+
+  std::unordered_map<std::string, baseGameFile> files;
+  std::unordered_set<std::string> packed;
+
+  for (const std::string &directory : getSearchDirectories(gameDir, appDir)) {
+
+    const std::filesystem::path directoryPath = gameDir / directory;
+    std::error_code error;
+    if (!std::filesystem::is_directory(directoryPath, error)) continue;
+
+    try {
+      for (const auto &entry : std::filesystem::recursive_directory_iterator(directoryPath, std::filesystem::directory_options::skip_permission_denied)) {
+        if (entry.is_symlink() || !entry.is_regular_file()) continue;
+
+        const std::string name = entry.path().lexically_relative(directoryPath).generic_string();
+
+        // VPK directory files sit at the top of a search path
+        if (entry.path().parent_path() == directoryPath && name.size() > 8 && name.compare(name.size() - 8, 8, "_dir.vpk") == 0) {
+          if (!readVPKNames(entry.path(), packed)) {
+            LOGFILE << "[W] Failed to read VPK " << entry.path() << std::endl;
+          }
+        }
+
+        // Files in higher priority directories hide those below them
+        if (files.count(name)) continue;
+
+        baseGameFile file;
+        file.directory = directory;
+        file.size = entry.file_size(error);
+        file.mtime = entry.last_write_time(error).time_since_epoch().count();
+        file.hashed = false;
+        file.crc = 0;
+        if (error) continue;
+
+        // Keep the checksum if the file looks the same as before
+        const auto previous = previousFiles.find(name);
+        if (previous != previousFiles.end() && previous->second.directory == directory && previous->second.size == file.size && previous->second.mtime == file.mtime) {
+          file.hashed = previous->second.hashed;
+          file.crc = previous->second.crc;
+        }
+
+        files[name] = file;
+      }
+    } catch (const std::filesystem::filesystem_error &e) {
+      LOGFILE << "[W] Failed to index base game files in " << directoryPath << ": " << e.what() << std::endl;
+      return;
+    }
+
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(baseGameMutex);
+
+    // Extractions may have checksummed files while this ran, which shouldn't have to be read again
+    for (auto &indexed : files) {
+      baseGameFile &file = indexed.second;
+      const auto current = baseGameFiles.find(indexed.first);
+      if (file.hashed || current == baseGameFiles.end() || !current->second.hashed) continue;
+      if (current->second.directory != file.directory || current->second.size != file.size || current->second.mtime != file.mtime) continue;
+      file.hashed = true;
+      file.crc = current->second.crc;
+    }
+
+    baseGameDir = gameDir;
+    baseGameAppDir = appDir;
+    baseGameFresh = true;
+    baseGameFiles = std::move(files);
+    baseGamePacked = std::move(packed);
+    baseGameDirty = true;
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    LOGFILE << "[I] Indexed " << baseGameFiles.size() << " base game files and " << baseGamePacked.size() << " packed files in " << seconds << "s" << std::endl;
+  }
+  ToolsBaseGame::saveIndex();
+
+}
+
+// Rebuilds the index of the given game's files on a background thread, unless that's been done this session already
+// Without a game directory, the one the stored index was built from gets indexed again, so that it's ready before the first install
+// Only one thread indexes at a time, requests made while it's busy are handled once it's done
+void ToolsBaseGame::startIndex (const std::filesystem::path gameDir, const std::string appDir) {
+
+  {
+    std::lock_guard<std::mutex> lock(baseGameMutex);
+    if (!gameDir.empty()) {
+      baseGameRequestedDir = gameDir;
+      baseGameRequestedAppDir = appDir;
+    }
+    if (baseGameIndexing) return;
+    baseGameIndexing = true;
+  }
+
+  std::thread([]() {
+
+    bool fromStored = true;
+    while (true) {
+
+      std::filesystem::path directory;
+      std::string appDirectory;
+      {
+        std::lock_guard<std::mutex> lock(baseGameMutex);
+        loadBaseGameIndex();
+
+        if (!baseGameRequestedDir.empty()) {
+          directory = baseGameRequestedDir;
+          appDirectory = baseGameRequestedAppDir;
+          baseGameRequestedDir.clear();
+        } else if (fromStored) {
+          directory = baseGameDir;
+          appDirectory = baseGameAppDir;
+        }
+        fromStored = false;
+
+        // Nothing left to do once the requested game is indexed, or if there's nothing to go on yet
+        if (directory.empty() || (baseGameFresh && directory == baseGameDir && appDirectory == baseGameAppDir)) {
+          if (baseGameRequestedDir.empty()) {
+            baseGameIndexing = false;
+            return;
+          }
+          continue;
+        }
+      }
+
+      ToolsBaseGame::updateIndex(directory, appDirectory);
+
+    }
+
+  }).detach();
+
+}
+
+// Looks up the current size and CRC64 of a loose base game file, checksumming it if it's new or has changed
+bool getBaseGameFileCRC (const std::string &name, uintmax_t &size, uint64_t &crc) {
+
+  baseGameFile entry;
+  std::filesystem::path path;
+  {
+    std::lock_guard<std::mutex> lock(baseGameMutex);
+    const auto found = baseGameFiles.find(name);
+    if (found == baseGameFiles.end()) return false;
+    entry = found->second;
+    path = baseGameDir / entry.directory / std::filesystem::u8path(name);
+  }
+
+  std::error_code error;
+  size = std::filesystem::file_size(path, error);
+  if (error) return false;
+  const int64_t mtime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+  if (error) return false;
+
+  if (entry.hashed && entry.size == size && entry.mtime == mtime) {
+    crc = entry.crc;
+    return true;
+  }
+
+  std::ifstream file(path, std::ios::binary);
+  std::vector<char> buffer(1 << 20);
+  crc = 0;
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    crc = lzma_crc64(reinterpret_cast<const uint8_t*>(buffer.data()), file.gcount(), crc);
+  }
+  if (!file.eof()) return false;
+
+  std::lock_guard<std::mutex> lock(baseGameMutex);
+  const auto found = baseGameFiles.find(name);
+  if (found != baseGameFiles.end()) {
+    found->second.size = size;
+    found->second.mtime = mtime;
+    found->second.crc = crc;
+    found->second.hashed = true;
+    baseGameDirty = true;
+  }
+
+  return true;
+
+}
+
+// Sets up an extraction filter which leaves out files identical to those of the selected game
+// Names of the files left out get added to `skipped`. Returns false if the game hasn't been indexed yet
+bool ToolsBaseGame::createFilter (ToolsExtract::EntryFilter &filter, std::vector<std::string> &skipped) {
+
+  {
+    std::lock_guard<std::mutex> lock(baseGameMutex);
+    loadBaseGameIndex();
+    if (baseGameFiles.empty() || baseGameAppDir != SPPLICE_STEAMAPP_DIRS[SPPLICE_STEAMAPP_INDEX]) {
+      LOGFILE << "[I] No index of " << SPPLICE_STEAMAPP_NAMES[SPPLICE_STEAMAPP_INDEX] << " files yet, extracting all package files" << std::endl;
+      return false;
+    }
+  }
+
+  // Loose files are only what the game sees if no VPK holds the same path
+  filter.isCandidate = [](const std::string &name, uintmax_t size) {
+    std::lock_guard<std::mutex> lock(baseGameMutex);
+    const auto found = baseGameFiles.find(name);
+    return found != baseGameFiles.end() && found->second.size == size && !baseGamePacked.count(toLowercase(name));
+  };
+
+  filter.isRedundant = [&skipped](const std::string &name, uintmax_t size, uint64_t crc) {
+    uintmax_t baseSize;
+    uint64_t baseCRC;
+    if (!getBaseGameFileCRC(name, baseSize, baseCRC)) return false;
+    if (baseSize != size || baseCRC != crc) return false;
+    skipped.push_back(name);
+    return true;
+  };
+
+  return true;
+
+}
+
+// Records which files were left out of an extracted tree, along with their checksums
+bool ToolsBaseGame::saveSkippedFiles (const std::filesystem::path tree, const std::vector<std::string> &skipped) {
+
+  std::filesystem::path skipPath = tree;
+  skipPath += ".skip";
+
+  std::error_code error;
+  std::filesystem::remove(skipPath, error);
+  if (skipped.empty()) return true;
+
+  std::ofstream file(skipPath);
+  if (!file.is_open()) return false;
+
+  for (const std::string &name : skipped) {
+    uintmax_t size;
+    uint64_t crc;
+    if (!getBaseGameFileCRC(name, size, crc)) {
+      file.close();
+      std::filesystem::remove(skipPath, error);
+      return false;
+    }
+    file << std::hex << crc << std::dec << '\t' << size << '\t' << name << '\n';
+  }
+
+  return true;
+
+}
+
+// Checks that the files left out of an extracted tree are still the same in the base game
+// Returns true if nothing was left out
+bool ToolsBaseGame::validateSkippedFiles (const std::filesystem::path tree) {
+
+  std::filesystem::path skipPath = tree;
+  skipPath += ".skip";
+  if (!std::filesystem::exists(skipPath)) return true;
+
+  {
+    std::lock_guard<std::mutex> lock(baseGameMutex);
+    loadBaseGameIndex();
+    if (baseGameAppDir != SPPLICE_STEAMAPP_DIRS[SPPLICE_STEAMAPP_INDEX]) return false;
+  }
+
+  std::ifstream file(skipPath);
+  std::string line;
+  while (std::getline(file, line)) {
+
+    std::istringstream fields(line);
+    std::string crc, name;
+    uintmax_t size;
+    fields >> crc >> size;
+    fields.ignore(1);
+    std::getline(fields, name);
+    if (fields.fail() || name.empty()) return false;
+
+    uintmax_t baseSize;
+    uint64_t baseCRC;
+    if (!getBaseGameFileCRC(name, baseSize, baseCRC)) return false;
+    if (baseSize != size || baseCRC != std::stoull(crc, nullptr, 16)) {
+      LOGFILE << "[I] Base game file \"" << name << "\" has changed since the package was extracted" << std::endl;
+      return false;
+    }
+
+  }
+
+  return true;
+
+}
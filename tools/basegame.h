@@ -0,0 +1,19 @@
+#ifndef TOOLS_BASEGAME_H
+#define TOOLS_BASEGAME_H
+
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "extract.h" // ToolsExtract
+
+class ToolsBaseGame {
+  public:
+    static void updateIndex (const std::filesystem::path gameDir, const std::string appDir);
+    static void startIndex (const std::filesystem::path gameDir = std::filesystem::path(), const std::string appDir = "");
+    static bool createFilter (ToolsExtract::EntryFilter &filter, std::vector<std::string> &skipped);
+    static void saveIndex ();
+    static bool saveSkippedFiles (const std::filesystem::path tree, const std::vector<std::string> &skipped);
+    static bool validateSkippedFiles (const std::filesystem::path tree);
+};
+
+#endif
@@ -2,25 +2,600 @@
 #include <fstream>
 #include <string>
 #include <filesystem>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <chrono>
 
 #include "../globals.h" // Project globals
+#include "progress.h" // ToolsProgress
+#include "mirror.h" // ToolsMirror
 
 // Definitions for this source file
 #include "curl.h"
 
+#ifndef TARGET_WINDOWS
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
 #ifndef TARGET_WINDOWS
   #include "../deps/linux/include/curl/curl.h"
+  #include <lzma.h>
 #else
   #include "../deps/win32/include/curl/curl.h"
+  #include "../deps/win32/include/lzma.h"
 #endif
 
-// Initializes CURL globally
+// Shared by every transfer, holds the DNS cache and TLS sessions
+// Connections themselves aren't shared between threads, as libcurl doesn't support that safely
+CURLSH *curlShare = nullptr;
+std::mutex curlShareLocks[CURL_LOCK_DATA_LAST];
+
+void curlShareLock (CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+  curlShareLocks[data].lock();
+}
+void curlShareUnlock (CURL *handle, curl_lock_data data, void *userptr) {
+  curlShareLocks[data].unlock();
+}
+
+// Idle easy handles, which keep their connections open for the next request that uses them
+std::vector<CURL*> curlHandlePool;
+std::mutex curlHandlePoolMutex;
+// Maximum number of idle handles to keep around
+#define CURL_HANDLE_POOL_SIZE 8
+
+// Takes a handle from the pool, or creates one if it's empty. Returns nullptr on failure
+CURL* acquireHandle () {
+
+  CURL *curl = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(curlHandlePoolMutex);
+    if (!curlHandlePool.empty()) {
+      curl = curlHandlePool.back();
+      curlHandlePool.pop_back();
+    }
+  }
+  if (!curl) curl = curl_easy_init();
+  if (!curl) return nullptr;
+
+  // Options common to all requests
+  curl_easy_setopt(curl, CURLOPT_SHARE, curlShare);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_USERAGENT, "spplice/3.0");
+  // Prefer HTTP/2 and wait for an existing connection to multiplex over instead of opening another
+  curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+  return curl;
+
+}
+
+// Returns a handle to the pool, clearing its options but keeping its connections
+void releaseHandle (CURL *curl) {
+
+  curl_easy_reset(curl);
+
+  std::lock_guard<std::mutex> lock(curlHandlePoolMutex);
+  if (curlHandlePool.size() < CURL_HANDLE_POOL_SIZE) {
+    curlHandlePool.push_back(curl);
+  } else {
+    curl_easy_cleanup(curl);
+  }
+
+}
+
+// A request handed to the transfer thread
+struct curlTransfer {
+  CURL *handle;
+  ToolsCURL::Priority priority = ToolsCURL::PRIORITY_INSTALL;
+  CURLcode result = CURLE_OK;
+  bool done = false;
+  // Detached transfers have nobody waiting on them, so the transfer thread cleans them up
+  bool detached = false;
+  // Set while the transfer is held back in favor of more important ones
+  bool paused = false;
+  // Set while the transfer waits for having gotten ahead of its share of the rate cap,
+  // along with the bytes it may still receive right now and the bytes received as of the last check
+  bool throttled = false;
+  double credit = 0;
+  std::chrono::steady_clock::time_point creditTime;
+  curl_off_t received = 0;
+  // Aborts the transfer once set, see ToolsCURL::cancelTransfers
+  const std::atomic<bool> *cancel = nullptr;
+};
+
+// A single multi handle runs every request made through performTransfer, so that requests
+// to the same host share its connections, multiplexed over HTTP/2 where the server supports it
+CURLM *transferMulti = nullptr;
+std::thread transferThread;
+std::deque<curlTransfer*> transferQueue;
+bool transferStop = false;
+std::mutex transferMutex;
+std::condition_variable transferUpdate;
+// Number of transfers of each class running on other threads, which can't be held back but hold back others
+int externalTransfers[ToolsCURL::PRIORITY_COUNT] = { 0 };
+// Share of the rate cap of each running transfer, as last split by the transfer thread
+std::atomic<curl_off_t> rateShare(0);
+
+// Returns true if transfers of the given class should wait, given how many of each class are running
+bool isTransferHeld (ToolsCURL::Priority priority, const int running[]) {
+  switch (priority) {
+    // Icons wait for installs to finish
+    case ToolsCURL::PRIORITY_ICON:
+      return running[ToolsCURL::PRIORITY_INSTALL] > 0;
+    // Background prefetches wait for everything else
+    case ToolsCURL::PRIORITY_PREFETCH:
+      return running[ToolsCURL::PRIORITY_INSTALL] + running[ToolsCURL::PRIORITY_INDEX] + running[ToolsCURL::PRIORITY_ICON] > 0;
+    // Installs are never held back, and neither are indexes, which are too small to get in the way
+    default:
+      return false;
+  }
+}
+
+// Reports the result of a transfer to whoever is waiting on it
+void finishTransfer (curlTransfer *transfer, CURLcode result) {
+
+  if (transfer->detached) {
+    releaseHandle(transfer->handle);
+    delete transfer;
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    transfer->result = result;
+    transfer->done = true;
+  }
+  transferUpdate.notify_all();
+
+}
+
+// Pauses or resumes reception of the given transfer, which stays paused while either held back or throttled
+void updatePause (const curlTransfer *transfer) {
+  curl_easy_pause(transfer->handle, transfer->paused || transfer->throttled ? CURLPAUSE_RECV : CURLPAUSE_CONT);
+}
+
+// Transfer thread loop, drives all queued requests until cleanup
+// Requests start in order of priority, and less important ones wait (or get paused) while more important ones run
+void transferLoop () {
+
+  std::unordered_map<CURL*, curlTransfer*> active;
+
+  while (true) {
+
+    // Count the running transfers of each class, including those on other threads
+    int running[ToolsCURL::PRIORITY_COUNT];
+    int externalCount = 0;
+
+    // Pick up newly queued requests, unless they're held back
+    {
+      std::lock_guard<std::mutex> lock(transferMutex);
+      if (transferStop) break;
+
+      for (int i = 0; i < ToolsCURL::PRIORITY_COUNT; i ++) {
+        running[i] = externalTransfers[i];
+        externalCount += externalTransfers[i];
+      }
+      for (auto &transfer : active) {
+        if (!transfer.second->paused) running[transfer.second->priority] ++;
+      }
+
+      // Drop cancelled requests before they start
+      for (auto it = transferQueue.begin(); it != transferQueue.end();) {
+        curlTransfer *transfer = *it;
+        if (!transfer->cancel || !*transfer->cancel) {
+          it ++;
+          continue;
+        }
+        it = transferQueue.erase(it);
+        transfer->result = CURLE_ABORTED_BY_CALLBACK;
+        transfer->done = true;
+        transferUpdate.notify_all();
+      }
+
+      std::stable_sort(transferQueue.begin(), transferQueue.end(), [](const curlTransfer *a, const curlTransfer *b) {
+        return a->priority < b->priority;
+      });
+      for (auto it = transferQueue.begin(); it != transferQueue.end();) {
+        curlTransfer *transfer = *it;
+        if (isTransferHeld(transfer->priority, running)) {
+          it ++;
+          continue;
+        }
+        it = transferQueue.erase(it);
+        running[transfer->priority] ++;
+        transfer->creditTime = std::chrono::steady_clock::now();
+        active[transfer->handle] = transfer;
+        curl_multi_add_handle(transferMulti, transfer->handle);
+      }
+    }
+
+    // Abort cancelled requests, whether or not they're paused
+    for (auto it = active.begin(); it != active.end();) {
+      if (!it->second->cancel || !*it->second->cancel) {
+        it ++;
+        continue;
+      }
+      curl_multi_remove_handle(transferMulti, it->first);
+      finishTransfer(it->second, CURLE_ABORTED_BY_CALLBACK);
+      it = active.erase(it);
+    }
+
+    // Pause transfers which have been overtaken by more important ones, and resume those that no longer are
+    int shares = externalCount;
+    for (auto &transfer : active) {
+      const bool held = isTransferHeld(transfer.second->priority, running);
+      if (held != transfer.second->paused) {
+        transfer.second->paused = held;
+        updatePause(transfer.second);
+      }
+      if (!held) shares ++;
+    }
+
+    // Split the rate cap evenly between the running transfers, including those on other threads, which pick up their share themselves
+    if (shares > 0) rateShare = (curl_off_t)(DOWNLOAD_RATE_LIMIT / shares);
+
+    // Keep each running transfer to its share with the same credit pacing as external transfers
+    // CURL's own speed limit can't be changed for requests already in flight, so transfers which get ahead are paused until their credit catches up
+    long pollTimeout = 1000;
+    const auto now = std::chrono::steady_clock::now();
+    for (auto &transfer : active) {
+      curlTransfer *current = transfer.second;
+
+      curl_off_t downloaded = 0;
+      curl_easy_getinfo(transfer.first, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+      const curl_off_t received = downloaded >= current->received ? downloaded - current->received : downloaded;
+      current->received = downloaded;
+
+      // Credit accrues at the transfer's share of the cap, up to a second's worth, but not while the transfer is held back
+      bool throttled = false;
+      if (DOWNLOAD_RATE_LIMIT > 0 && shares > 0 && !current->paused) {
+        const double share = DOWNLOAD_RATE_LIMIT / shares;
+        const double elapsed = std::chrono::duration<double>(now - current->creditTime).count();
+        current->credit = std::min<double>(current->credit + elapsed * share, share) - received;
+        throttled = current->credit < 0;
+        // Wake up in time to resume the transfer once it has made up the difference
+        if (throttled) pollTimeout = std::min(pollTimeout, (long)(-current->credit / share * 1000) + 1);
+      }
+      current->creditTime = now;
+
+      if (throttled != current->throttled) {
+        current->throttled = throttled;
+        updatePause(current);
+      }
+    }
+
+    int runningHandles;
+    curl_multi_perform(transferMulti, &runningHandles);
+
+    // Hand back finished requests
+    CURLMsg *message;
+    int remaining;
+    while ((message = curl_multi_info_read(transferMulti, &remaining))) {
+      if (message->msg != CURLMSG_DONE) continue;
+      CURL *handle = message->easy_handle;
+      const CURLcode result = message->data.result;
+      curl_multi_remove_handle(transferMulti, handle);
+      finishTransfer(active[handle], result);
+      active.erase(handle);
+    }
+
+    // Sleep until there's network activity, or until woken up by a new request
+    curl_multi_poll(transferMulti, nullptr, 0, pollTimeout, nullptr);
+
+  }
+
+  // Fail whatever is still in flight
+  for (auto &transfer : active) {
+    curl_multi_remove_handle(transferMulti, transfer.first);
+    finishTransfer(transfer.second, CURLE_ABORTED_BY_CALLBACK);
+  }
+  std::lock_guard<std::mutex> lock(transferMutex);
+  for (curlTransfer *transfer : transferQueue) {
+    if (transfer->detached) {
+      curl_easy_cleanup(transfer->handle);
+      delete transfer;
+    } else {
+      transfer->result = CURLE_ABORTED_BY_CALLBACK;
+      transfer->done = true;
+    }
+  }
+  transferQueue.clear();
+  transferUpdate.notify_all();
+
+}
+
+// Queues requests of the given class on the transfer thread and waits for all of them to finish, returns their results in order
+// The requests are aborted if the given flag gets set through ToolsCURL::cancelTransfers
+std::vector<CURLcode> performTransfers (const std::vector<CURL*> &handles, ToolsCURL::Priority priority, const std::atomic<bool> *cancel = nullptr) {
+
+  std::vector<curlTransfer> transfers(handles.size());
+
+  {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    if (!transferMulti || transferStop) return std::vector<CURLcode>(handles.size(), CURLE_FAILED_INIT);
+    for (size_t i = 0; i < handles.size(); i ++) {
+      transfers[i].handle = handles[i];
+      transfers[i].priority = priority;
+      transfers[i].cancel = cancel;
+      transferQueue.push_back(&transfers[i]);
+    }
+  }
+  curl_multi_wakeup(transferMulti);
+
+  std::unique_lock<std::mutex> lock(transferMutex);
+  transferUpdate.wait(lock, [&transfers]() {
+    return std::all_of(transfers.begin(), transfers.end(), [](const curlTransfer &transfer) { return transfer.done; });
+  });
+
+  std::vector<CURLcode> results;
+  for (const curlTransfer &transfer : transfers) results.push_back(transfer.result);
+  return results;
+
+}
+
+// Queues a request of the given class on the transfer thread. Unless detached, waits for it to finish and returns its result
+CURLcode performTransfer (CURL *curl, ToolsCURL::Priority priority, bool detached = false, const std::atomic<bool> *cancel = nullptr) {
+
+  if (!detached) return performTransfers({ curl }, priority, cancel)[0];
+
+  curlTransfer *transfer = new curlTransfer;
+  transfer->handle = curl;
+  transfer->priority = priority;
+  transfer->detached = true;
+
+  {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    if (!transferMulti || transferStop) {
+      delete transfer;
+      curl_easy_cleanup(curl);
+      return CURLE_FAILED_INIT;
+    }
+    transferQueue.push_back(transfer);
+  }
+  curl_multi_wakeup(transferMulti);
+
+  return CURLE_OK;
+
+}
+
+// Aborts every transfer started with the given flag
+void ToolsCURL::cancelTransfers (std::atomic<bool> &cancel) {
+  cancel = true;
+  if (transferMulti) curl_multi_wakeup(transferMulti);
+}
+
+// Progress of a single download, which may take several requests to complete
+struct transferProgress {
+  // Bytes reported by CURL's progress callback for the current request
+  curl_off_t received = 0;
+  // Bytes counted towards the install progress over all requests, and those counted before the current one
+  curl_off_t counted = 0;
+  curl_off_t base = 0;
+  // Bytes the install progress currently expects this download to take
+  curl_off_t expected = 0;
+  // Set if the transfer counts towards the install progress
+  bool install = false;
+  // Set if the transfer keeps to its share of the rate cap by itself, along with the bytes it may still receive right now
+  bool paced = false;
+  double credit = 0;
+  std::chrono::steady_clock::time_point creditTime;
+};
+
+// Sets the total number of bytes the given download is expected to take, replacing its earlier estimate
+// Retries and fallbacks thus correct the install's total rather than adding to it
+void expectTransfer (transferProgress &progress, curl_off_t total) {
+  if (total == progress.expected) return;
+  ToolsProgress::expect(ToolsProgress::STAGE_DOWNLOAD, 0, total - progress.expected);
+  progress.expected = total;
+}
+
+// Counts the given number of received bytes towards the install progress
+void countTransfer (transferProgress &progress, curl_off_t bytes) {
+  ToolsProgress::add(ToolsProgress::STAGE_DOWNLOAD, 0, bytes);
+  progress.counted += bytes;
+}
+
+// Starts a new request of the given download, whose expected size adds to what earlier requests have received
+void restartTransfer (transferProgress &progress) {
+  progress.received = 0;
+  progress.base = progress.counted;
+}
+
+// CURL progress callback function which counts received bytes towards the install progress,
+// and holds back paced transfers which have gotten ahead of their share of the rate cap
+int curlProgressCallback (void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+
+  transferProgress *progress = static_cast<transferProgress *>(clientp);
+  const curl_off_t received = dlnow > progress->received ? dlnow - progress->received : 0;
+  progress->received = std::max(progress->received, dlnow);
+
+  if (progress->install && dltotal > 0) expectTransfer(*progress, progress->base + dltotal);
+  if (progress->install && received > 0) countTransfer(*progress, received);
+
+  // Credit accrues at the transfer's share of the cap, up to a second's worth, and blocking the callback stops reception
+  const curl_off_t share = rateShare > 0 ? rateShare.load() : (curl_off_t)DOWNLOAD_RATE_LIMIT;
+  if (progress->paced && share > 0) {
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed = std::chrono::duration<double>(now - progress->creditTime).count();
+    progress->credit = std::min<double>(progress->credit + elapsed * share, share) - received;
+    progress->creditTime = now;
+    if (progress->credit < 0) {
+      std::this_thread::sleep_for(std::chrono::duration<double>(-progress->credit / share));
+      progress->credit = 0;
+      progress->creditTime = std::chrono::steady_clock::now();
+    }
+  }
+
+  return 0;
+
+}
+
+// Reports the progress of the given transfer if it's part of an install
+void trackProgress (CURL *curl, transferProgress &progress, ToolsCURL::Priority priority) {
+  if (priority != ToolsCURL::PRIORITY_INSTALL) return;
+  progress.install = true;
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curlProgressCallback);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+}
+
+// Performs a request on the calling thread, while still holding back less important transfers on the transfer thread
+// Used where the write callback may block, which would stall every other transfer if it ran on the transfer thread
+CURLcode performExternalTransfer (CURL *curl, transferProgress &progress, ToolsCURL::Priority priority) {
+
+  {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    externalTransfers[priority] ++;
+  }
+  if (transferMulti) curl_multi_wakeup(transferMulti);
+
+  // The transfer thread can't pause a request it doesn't run, so this one keeps to its share of the rate cap by itself
+  if (DOWNLOAD_RATE_LIMIT > 0) {
+    progress.paced = true;
+    progress.credit = 0;
+    progress.creditTime = std::chrono::steady_clock::now();
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curlProgressCallback);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &progress);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  }
+  CURLcode response = curl_easy_perform(curl);
+
+  {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    externalTransfers[priority] --;
+  }
+  if (transferMulti) curl_multi_wakeup(transferMulti);
+
+  return response;
+
+}
+
+// Initializes CURL globally, along with the shared caches and the transfer thread
 void ToolsCURL::init () {
+
   curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  curlShare = curl_share_init();
+  curl_share_setopt(curlShare, CURLSHOPT_LOCKFUNC, curlShareLock);
+  curl_share_setopt(curlShare, CURLSHOPT_UNLOCKFUNC, curlShareUnlock);
+  curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(curlShare, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  transferMulti = curl_multi_init();
+  curl_multi_setopt(transferMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  // Servers without HTTP/2 get a handful of parallel connections at most, further requests wait their turn
+  curl_multi_setopt(transferMulti, CURLMOPT_MAX_HOST_CONNECTIONS, 6L);
+  transferThread = std::thread(transferLoop);
+
 }
 // Cleans up CURL globally
 void ToolsCURL::cleanup () {
+
+  {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    transferStop = true;
+  }
+  if (transferMulti) {
+    curl_multi_wakeup(transferMulti);
+    if (transferThread.joinable()) transferThread.join();
+    curl_multi_cleanup(transferMulti);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(curlHandlePoolMutex);
+    for (CURL *curl : curlHandlePool) curl_easy_cleanup(curl);
+    curlHandlePool.clear();
+  }
+
+  curl_share_cleanup(curlShare);
   curl_global_cleanup();
+
+}
+
+// CURL write callback function which discards the received data
+size_t curlDiscardWriteCallback (void *contents, size_t size, size_t nmemb, void *userp) {
+  return size * nmemb;
+}
+
+// Origins which have already been pre-connected to
+std::unordered_set<std::string> preconnectedOrigins;
+std::mutex preconnectMutex;
+
+// Opens a connection to the origin of the given URL in the background, so that later requests skip the handshakes
+void ToolsCURL::preconnect (const std::string &url) {
+
+  // Reduce the URL to its scheme, host and port
+  const size_t schemeEnd = url.find("://");
+  if (schemeEnd == std::string::npos) return;
+  const std::string scheme = url.substr(0, schemeEnd);
+  if (scheme != "http" && scheme != "https") return;
+  const std::string origin = url.substr(0, url.find('/', schemeEnd + 3));
+
+  {
+    std::lock_guard<std::mutex> lock(preconnectMutex);
+    if (!preconnectedOrigins.insert(origin).second) return;
+  }
+
+  CURL *curl = acquireHandle();
+  if (!curl) return;
+
+  // A HEAD request leaves a reusable connection behind, unlike CURLOPT_CONNECT_ONLY
+  curl_easy_setopt(curl, CURLOPT_URL, (origin + "/").c_str());
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 0L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlDiscardWriteCallback);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10L);
+
+  LOGFILE << "[I] Pre-connecting to " << origin << std::endl;
+  performTransfer(curl, ToolsCURL::PRIORITY_INDEX, true);
+
+}
+
+// Measures how long each of the given URLs takes to start responding, in seconds, or -1 if it doesn't within the timeout (in seconds)
+// The time includes setting up the connection, as it would for a download that doesn't find one to reuse
+std::vector<double> ToolsCURL::probeLatency (const std::vector<std::string> &urls, long timeout) {
+
+  std::vector<double> latencies(urls.size(), -1);
+  std::vector<CURL*> handles;
+
+  for (const std::string &url : urls) {
+    CURL *curl = acquireHandle();
+    if (!curl) break;
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlDiscardWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    handles.push_back(curl);
+  }
+
+  // Probes are as small as index requests, and shouldn't wait behind anything either
+  const std::vector<CURLcode> results = performTransfers(handles, PRIORITY_INDEX);
+
+  for (size_t i = 0; i < handles.size(); i ++) {
+    long status = 0;
+    curl_off_t time = 0;
+    curl_easy_getinfo(handles[i], CURLINFO_RESPONSE_CODE, &status);
+    curl_easy_getinfo(handles[i], CURLINFO_STARTTRANSFER_TIME_T, &time);
+    releaseHandle(handles[i]);
+
+    if (results[i] == CURLE_OK && status < 400) latencies[i] = time / 1e6;
+    else LOGFILE << "[W] Probe of \"" << urls[i] << "\" failed: "
+      << (results[i] != CURLE_OK ? curl_easy_strerror(results[i]) : "HTTP " + std::to_string(status)) << std::endl;
+  }
+
+  return latencies;
+
 }
 
 // CURL write callback function for appending to a string
@@ -29,58 +604,1043 @@ size_t curlStringWriteCallback (void *contents, size_t size, size_t nmemb, void
   return size *nmemb;
 }
 
-// CURL write callback function for writing to a file
-size_t curlFileWriteCallback (void *contents, size_t size, size_t nmemb, void *userp) {
-  std::ofstream *ofs = static_cast<std::ofstream *>(userp);
+// Details of the last response received, gathered from its headers
+struct responseHeaders {
+  long status = 0;
+  std::string etag;
+  std::string lastModified;
+  bool acceptsRanges = false;
+  // Size of the whole file, whether the response holds all of it or a range (-1 if unknown)
+  curl_off_t totalSize = -1;
+};
+
+// CURL header callback function which collects the headers of the final response
+size_t curlHeaderCallback (char *buffer, size_t size, size_t nitems, void *userp) {
+
+  responseHeaders *headers = static_cast<responseHeaders *>(userp);
+  const std::string line(buffer, size * nitems);
+
+  // Every response in a redirect chain starts with a status line, only the last one counts
+  if (line.rfind("HTTP/", 0) == 0) {
+    *headers = responseHeaders();
+    const size_t space = line.find(' ');
+    if (space != std::string::npos) headers->status = std::atol(line.c_str() + space + 1);
+    return size * nitems;
+  }
+
+  const size_t colon = line.find(':');
+  if (colon == std::string::npos) return size * nitems;
+
+  std::string name = line.substr(0, colon);
+  std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::tolower(c); });
+  std::string value = line.substr(colon + 1);
+  value.erase(0, value.find_first_not_of(" \t"));
+  value.erase(value.find_last_not_of(" \t\r\n") + 1);
+
+  if (name == "etag") headers->etag = value;
+  else if (name == "last-modified") headers->lastModified = value;
+  else if (name == "accept-ranges") headers->acceptsRanges = value.find("bytes") != std::string::npos;
+  else if (name == "content-length" && headers->status == 200) headers->totalSize = std::atoll(value.c_str());
+  else if (name == "content-range" && value.find('/') != std::string::npos) headers->totalSize = std::atoll(value.c_str() + value.find('/') + 1);
+
+  return size * nitems;
+
+}
+
+// Returns a value identifying this version of the file for If-Range, or an empty string if there is none
+// Weak ETags can't be used with ranges, so the modification date is used instead
+std::string getValidator (const responseHeaders &headers) {
+  if (!headers.etag.empty() && headers.etag.rfind("W/", 0) != 0) return headers.etag;
+  return headers.lastModified;
+}
+
+// Progress of an interrupted download, recorded next to its .part file so that it can be resumed
+struct partialDownload {
+  std::string url;
+  std::string validator;
+  curl_off_t size = -1;
+  // Start, length and received byte count of each range of a segmented download
+  std::vector<std::array<curl_off_t, 3>> segments;
+};
+
+// Returns the path which a download is written to until it's complete
+std::filesystem::path getPartPath (std::filesystem::path outputPath) {
+  outputPath += ".part";
+  return outputPath;
+}
+
+// Returns the path of the progress record of an unfinished download
+std::filesystem::path getProgressPath (std::filesystem::path outputPath) {
+  outputPath += ".progress";
+  return outputPath;
+}
+
+// Reads the progress record of an interrupted download, returns false if there is none
+bool readPartialDownload (const std::filesystem::path outputPath, partialDownload &partial) {
+  std::ifstream file(getProgressPath(outputPath));
+  if (!std::getline(file, partial.url) || !std::getline(file, partial.validator) || !(file >> partial.size)) return false;
+  std::array<curl_off_t, 3> segment;
+  while (file >> segment[0] >> segment[1] >> segment[2]) partial.segments.push_back(segment);
+  return true;
+}
+
+// Records the progress of a download, so that it can be resumed if it gets interrupted
+void writePartialDownload (const std::filesystem::path outputPath, const partialDownload &partial) {
+  std::ofstream file(getProgressPath(outputPath));
+  file << partial.url << '\n' << partial.validator << '\n' << partial.size << '\n';
+  for (const auto &segment : partial.segments) {
+    file << segment[0] << ' ' << segment[1] << ' ' << segment[2] << '\n';
+  }
+}
+
+// Removes the .part file and progress record of an unfinished download
+void ToolsCURL::discardPartial (const std::filesystem::path outputPath) {
+  std::error_code error;
+  std::filesystem::remove(getPartPath(outputPath), error);
+  std::filesystem::remove(getProgressPath(outputPath), error);
+}
+
+// Moves a completed download into place, returns true if successful
+// Renaming replaces any existing file rather than truncating it, as it might still be memory-mapped by an extraction
+bool promotePartial (const std::filesystem::path outputPath) {
+
+  std::error_code error;
+  std::filesystem::rename(getPartPath(outputPath), outputPath, error);
+  if (error) {
+    LOGFILE << "[E] Failed to move download into place at " << outputPath << ": " << error.message() << std::endl;
+    ToolsCURL::discardPartial(outputPath);
+    return false;
+  }
+
+  std::filesystem::remove(getProgressPath(outputPath), error);
+  return true;
+
+}
+
+// Returns true if the given list of sources contains the given URL
+bool hasSource (const std::vector<std::string> &urls, const std::string &url) {
+  return std::find(urls.begin(), urls.end(), url) != urls.end();
+}
+
+// Returns how many bytes of an earlier single-stream download from any of the given sources can be reused
+// Anything that can't be reused gets discarded
+curl_off_t getResumeOffset (const std::vector<std::string> &urls, const std::filesystem::path outputPath, partialDownload &partial) {
+
+  std::error_code error;
+  curl_off_t offset = 0;
+
+  if (readPartialDownload(outputPath, partial) && hasSource(urls, partial.url) && !partial.validator.empty() && partial.segments.empty()) {
+    offset = std::filesystem::file_size(getPartPath(outputPath), error);
+    if (error) offset = 0;
+  }
+
+  if (offset == 0) {
+    ToolsCURL::discardPartial(outputPath);
+    partial = partialDownload();
+  }
+  return offset;
+
+}
+
+// Makes the given source the one a partial download is checked against, after it sent the file from the start
+void adoptSource (partialDownload &partial, const std::string &url, const responseHeaders &headers) {
+  partial = partialDownload();
+  partial.url = url;
+  partial.validator = getValidator(headers);
+  partial.size = headers.totalSize;
+}
+
+// Keeps the .part file of a failed single-stream download for the next attempt, if the server said which version of the file it is
+void keepPartial (const std::filesystem::path outputPath, const partialDownload &partial) {
+
+  std::error_code error;
+  const uintmax_t received = std::filesystem::file_size(getPartPath(outputPath), error);
+
+  if (partial.validator.empty() || error || received == 0) {
+    ToolsCURL::discardPartial(outputPath);
+    return;
+  }
+
+  writePartialDownload(outputPath, partial);
+  LOGFILE << "[I] Kept " << (received >> 10) << " KiB of \"" << partial.url << "\" to resume from" << std::endl;
+
+}
+
+// Returns the CRC64 of the given range of a file, continuing from the given CRC64 of whatever came before it
+// Used to pick up the checksum of data received by an earlier attempt
+uint64_t getFileCRC64 (const std::filesystem::path path, curl_off_t start, curl_off_t length, uint64_t crc = 0) {
+
+  std::ifstream file(path, std::ios::binary);
+  file.seekg(start);
+  std::vector<char> buffer(1 << 20);
+
+  while (length > 0) {
+    file.read(buffer.data(), std::min<curl_off_t>(buffer.size(), length));
+    if (file.gcount() <= 0) break;
+    crc = lzma_crc64(reinterpret_cast<const uint8_t*>(buffer.data()), file.gcount(), crc);
+    length -= file.gcount();
+  }
+
+  return crc;
+
+}
+
+// Multiplies a 64x64 bit matrix over GF(2) by a vector
+uint64_t gf2MatrixTimes (const uint64_t *matrix, uint64_t vector) {
+  uint64_t sum = 0;
+  for (; vector; vector >>= 1, matrix ++) {
+    if (vector & 1) sum ^= *matrix;
+  }
+  return sum;
+}
+
+// Squares a 64x64 bit matrix over GF(2)
+void gf2MatrixSquare (uint64_t *square, const uint64_t *matrix) {
+  for (int i = 0; i < 64; i ++) square[i] = gf2MatrixTimes(matrix, matrix[i]);
+}
+
+// Returns the CRC64 of two blocks of data one after another, given the CRC64 of each and the length of the second
+// Works like zlib's crc32_combine, with the reflected polynomial used by lzma_crc64
+uint64_t combineCRC64 (uint64_t first, uint64_t second, uint64_t secondLength) {
+
+  if (secondLength == 0) return first;
+
+  // Operators that feed one, two and four zero bits through the CRC
+  uint64_t even[64], odd[64];
+  odd[0] = 0xC96C5795D7870F42ULL;
+  for (int i = 1; i < 64; i ++) odd[i] = 1ULL << (i - 1);
+  gf2MatrixSquare(even, odd);
+  gf2MatrixSquare(odd, even);
+
+  // Feed as many zero bytes as the second block is long through the first CRC, squaring the operator for each bit of the length
+  do {
+    gf2MatrixSquare(even, odd);
+    if (secondLength & 1) first = gf2MatrixTimes(even, first);
+    secondLength >>= 1;
+    if (secondLength == 0) break;
+    gf2MatrixSquare(odd, even);
+    if (secondLength & 1) first = gf2MatrixTimes(odd, first);
+    secondLength >>= 1;
+  } while (secondLength != 0);
+
+  return first ^ second;
+
+}
+
+// Transfers receiving less than DOWNLOAD_STALL_SPEED bytes per second for DOWNLOAD_STALL_TIME seconds are considered stalled
+// Transfers held back in favor of more important ones don't count, as libcurl skips the check while they're paused
+#define DOWNLOAD_STALL_SPEED 1024
+#define DOWNLOAD_STALL_TIME 15
+
+// Makes the given transfer give up once it stalls, for when there's another source to continue from
+void abortOnStall (CURL *curl) {
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, (long)DOWNLOAD_STALL_SPEED);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)DOWNLOAD_STALL_TIME);
+}
+
+// Feeds the outcome of a finished transfer from the given source into the statistics of its host
+// Parallel segments share the connection's bandwidth, so only their latency says something about the host
+void recordSource (CURL *curl, const std::string &url, CURLcode result, long status, bool measureThroughput) {
+
+  // Failures on this end say nothing about the host
+  if (result == CURLE_ABORTED_BY_CALLBACK || result == CURLE_WRITE_ERROR || result == CURLE_FILESIZE_EXCEEDED) return;
+
+  if (result != CURLE_OK || status >= 400) {
+    ToolsMirror::recordFailure(url);
+    return;
+  }
+
+  curl_off_t startTime = 0, totalTime = 0, received = 0;
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &startTime);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &totalTime);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+  if (!measureThroughput) received = 0;
+
+  ToolsMirror::recordTransfer(url, startTime / 1e6, received, (totalTime - startTime) / 1e6);
+
+}
+
+// Destination of a resumable download
+struct resumableTarget {
+  std::ofstream file;
+  std::filesystem::path path;
+  responseHeaders headers;
+  // Bytes already in the file when the request was made
+  curl_off_t offset = 0;
+  bool started = false;
+  // Size which a source other than the one the file came from has to report for its data to fit (-1 to skip the check)
+  curl_off_t expectedSize = -1;
+  // Set if that source turned out to have a different file
+  bool mismatch = false;
+  // CRC64 of everything in the file so far
+  uint64_t crc = 0;
+};
+
+// CURL write callback function for writing to a resumable file
+size_t curlResumableWriteCallback (void *contents, size_t size, size_t nmemb, void *userp) {
+
+  resumableTarget *target = static_cast<resumableTarget *>(userp);
   size_t totalSize = size * nmemb;
-  ofs->write(static_cast<const char *>(contents), totalSize);
+
+  // Error pages aren't worth keeping
+  if (target->headers.status >= 400) return totalSize;
+
+  // If the file has changed, the server sends all of it instead of the rest, so start over
+  if (!target->started) {
+    target->started = true;
+    if (target->offset > 0 && target->headers.status == 200) {
+      target->file.close();
+      target->file.open(target->path, std::ios::binary | std::ios::trunc);
+      target->offset = 0;
+      target->crc = 0;
+    } else if (target->offset > 0 && target->expectedSize > 0 && target->headers.totalSize != target->expectedSize) {
+      target->mismatch = true;
+      return 0;
+    }
+  }
+
+  target->file.write(static_cast<const char *>(contents), totalSize);
+  if (!target->file) return 0;
+  target->crc = lzma_crc64(static_cast<const uint8_t *>(contents), totalSize, target->crc);
   return totalSize;
+
 }
 
-// Downloads a file from the specified URL to the specified path, returns true if successful
-bool ToolsCURL::downloadFile (const std::string &url, const std::filesystem::path outputPath) {
+// Outcome of a download attempt from one of the file's sources
+enum sourceResult { SOURCE_COMPLETE, SOURCE_FAILED, SOURCE_REFUSED };
 
-  std::ofstream ofs(outputPath, std::ios::binary);
+// Downloads a file from one of its sources to the specified path
+// Returns SOURCE_FAILED if the next source is worth a try, or SOURCE_REFUSED if no source would do better
+// Once complete, the CRC64 of the file is written to `checksum` (if given)
+sourceResult downloadFromSource (const std::vector<std::string> &urls, size_t source, const std::filesystem::path outputPath, ToolsCURL::Priority priority, curl_off_t maxSize, const std::atomic<bool> *cancel, transferProgress &progress, uint64_t *checksum) {
 
-  if (!ofs.is_open()) {
-    LOGFILE << "[E] Failed to open file for writing: " << outputPath << std::endl;
-    return false;
+  const std::string &url = urls[source];
+
+  // Pick up where an earlier attempt at the same download left off, possibly on another source
+  partialDownload partial;
+  curl_off_t offset = getResumeOffset(urls, outputPath, partial);
+
+  // Other sources can't check the part against their version of the file, so the size has to do
+  const bool sameSource = partial.url == url;
+  if (offset > 0 && !sameSource && partial.size <= 0) {
+    ToolsCURL::discardPartial(outputPath);
+    partial = partialDownload();
+    offset = 0;
   }
 
-  // Initialize CURL
-  CURL *curl = curl_easy_init();
+  resumableTarget target;
+  target.path = getPartPath(outputPath);
+  target.offset = offset;
+  if (!sameSource) target.expectedSize = partial.size;
+  if (offset > 0) target.crc = getFileCRC64(target.path, 0, offset);
+  target.file.open(target.path, std::ios::binary | (offset > 0 ? std::ios::app : std::ios::trunc));
+
+  if (!target.file.is_open()) {
+    LOGFILE << "[E] Failed to open file for writing: " << target.path << std::endl;
+    return SOURCE_REFUSED;
+  }
+
+  // Take a CURL handle from the pool
+  CURL *curl = acquireHandle();
 
   if (!curl) {
     LOGFILE << "[E] Failed to initialize CURL" << std::endl;
-    return false;
+    return SOURCE_REFUSED;
   }
 
   // Set request parameters
   curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlFileWriteCallback);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ofs);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_USERAGENT, "spplice/3.0");
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlResumableWriteCallback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &target);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &target.headers);
+  if (maxSize > 0) curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, maxSize);
+  if (source + 1 < urls.size()) abortOnStall(curl);
+  restartTransfer(progress);
+  trackProgress(curl, progress, priority);
 
-  CURLcode response = curl_easy_perform(curl);
+  // Only ask for the missing bytes, unless the file has changed since
+  const std::string range = std::to_string(offset) + "-";
+  struct curl_slist *requestHeaders = nullptr;
+  if (offset > 0) {
+    if (sameSource) {
+      LOGFILE << "[I] Resuming download of \"" << url << "\" at " << (offset >> 10) << " KiB" << std::endl;
+      requestHeaders = curl_slist_append(requestHeaders, ("If-Range: " + partial.validator).c_str());
+      curl_easy_setopt(curl, CURLOPT_HTTPHEADER, requestHeaders);
+    } else {
+      LOGFILE << "[I] Continuing download of \"" << partial.url << "\" from \"" << url << "\" at " << (offset >> 10) << " KiB" << std::endl;
+    }
+    curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+  }
 
-  // Clean up CURL
-  curl_easy_cleanup(curl);
+  CURLcode response = performTransfer(curl, priority, false, cancel);
+  const long status = target.headers.status;
+  if (urls.size() > 1) recordSource(curl, url, target.mismatch ? CURLE_RANGE_ERROR : response, status, priority == ToolsCURL::PRIORITY_INSTALL);
+
+  // Return the handle to the pool
+  releaseHandle(curl);
+  curl_slist_free_all(requestHeaders);
+  target.file.close();
+
+  // The kept part can't be continued, most likely because it was complete already, so start over
+  if (response == CURLE_OK && status == 416 && offset > 0) {
+    ToolsCURL::discardPartial(outputPath);
+    return downloadFromSource(urls, source, outputPath, priority, maxSize, cancel, progress, checksum);
+  }
+
+  if (target.mismatch) {
+    LOGFILE << "[W] \"" << url << "\" has a different file than \"" << partial.url << "\", skipping it" << std::endl;
+    return SOURCE_FAILED;
+  }
+
+  if (response == CURLE_OK && status >= 400) {
+    LOGFILE << "[E] Failed to download file from \"" << url << "\": HTTP " << status << std::endl;
+    // Another source's part is still good for the next one
+    if (sameSource || offset == 0) ToolsCURL::discardPartial(outputPath);
+    return SOURCE_FAILED;
+  }
 
   if (response != CURLE_OK) {
     LOGFILE << "[E] Failed to download file from \"" << url << "\": " << curl_easy_strerror(response) << std::endl;
+    if (status == 200) adoptSource(partial, url, target.headers);
+    keepPartial(outputPath, partial);
+    // Other sources wouldn't fare any better with a file that's too large, can't be written, or isn't wanted anymore
+    if (response == CURLE_FILESIZE_EXCEEDED || response == CURLE_WRITE_ERROR || (cancel && *cancel)) return SOURCE_REFUSED;
+    return SOURCE_FAILED;
+  }
+
+  if (checksum) *checksum = target.crc;
+  return promotePartial(outputPath) ? SOURCE_COMPLETE : SOURCE_REFUSED;
+
+}
+
+// Downloads a file from the first of the specified URLs that works to the specified path, returns true if successful
+// The data goes to a .part file until it's complete, and an interrupted download continues from there on the next attempt,
+// or right away from the next source if there is one
+// Files larger than maxSize (unless 0) are refused, and the download stops early if the cancel flag (if any) gets set
+// The CRC64 of the file is computed as it arrives, and written to `checksum` (if given) once it's complete
+// A download that takes over from another one passes on its progress (if any), so that the install's total isn't counted twice
+bool downloadResumable (const std::vector<std::string> &urls, const std::filesystem::path outputPath, ToolsCURL::Priority priority, curl_off_t maxSize, const std::atomic<bool> *cancel, uint64_t *checksum = nullptr, transferProgress *previous = nullptr) {
+
+  transferProgress fresh;
+  transferProgress &progress = previous ? *previous : fresh;
+
+  sourceResult result = SOURCE_FAILED;
+  for (size_t source = 0; source < urls.size() && result == SOURCE_FAILED; source ++) {
+    result = downloadFromSource(urls, source, outputPath, priority, maxSize, cancel, progress, checksum);
+  }
+
+  // What was learned about the sources gets written out once, rather than after each one
+  ToolsMirror::saveStats();
+  return result == SOURCE_COMPLETE;
+
+}
+
+// Downloads a file from the specified URL to the specified path, returns true if successful
+bool ToolsCURL::downloadFile (const std::string &url, const std::filesystem::path outputPath, Priority priority) {
+  return downloadResumable({ url }, outputPath, priority, 0, nullptr);
+}
+
+// Downloads a file in the background ahead of when it's needed, returns true if it was fetched in full
+// Files larger than maxSize are refused, and an interrupted prefetch is picked up by the next download to the same path
+bool ToolsCURL::prefetchFile (const std::vector<std::string> &urls, const std::filesystem::path outputPath, curl_off_t maxSize, const std::atomic<bool> &cancel, uint64_t *checksum) {
+  return downloadResumable(urls, outputPath, PRIORITY_PREFETCH, maxSize, &cancel, checksum);
+}
+
+// Files smaller than this are never downloaded in segments
+#define DOWNLOAD_SEGMENT_MIN_SIZE (32 << 20)
+// Amount of data received across all segments between updates of the progress record
+#define DOWNLOAD_SEGMENT_RECORD_INTERVAL (16 << 20)
+
+struct segmentedDownload;
+
+// Receives the data of a single byte range into its place in the .part file
+struct downloadSegment {
+  segmentedDownload *download;
+  std::fstream file;
+  curl_off_t start;
+  curl_off_t length;
+  curl_off_t received = 0;
+  // Index of the source this segment is fetched from, which moves on to the next one if it fails
+  size_t source = 0;
+  responseHeaders headers;
+  // CRC64 of the received part of the range
+  uint64_t crc = 0;
+  // Set if the server didn't honor the range, which makes retrying pointless
+  bool failed = false;
+};
+
+// State shared by all segments of a download
+struct segmentedDownload {
+  std::filesystem::path outputPath;
+  partialDownload partial;
+  // Whether received data counts towards the install progress, and how much of it has
+  bool trackProgress = false;
+  transferProgress progress;
+  std::vector<downloadSegment> segments;
+  // Bytes received since the progress record was last written
+  curl_off_t unrecorded = 0;
+};
+
+// Writes the progress record of a segmented download, once everything it counts has been handed to the OS
+void recordSegmentedDownload (segmentedDownload &download) {
+  download.partial.segments.clear();
+  for (downloadSegment &segment : download.segments) {
+    segment.file.flush();
+    download.partial.segments.push_back({ segment.start, segment.length, segment.received });
+  }
+  writePartialDownload(download.outputPath, download.partial);
+  download.unrecorded = 0;
+}
+
+// CURL write callback function for writing a segment
+// All segments are written from the transfer thread, so they can update the shared progress record without locking
+size_t curlSegmentWriteCallback (void *contents, size_t size, size_t nmemb, void *userp) {
+
+  downloadSegment *segment = static_cast<downloadSegment *>(userp);
+  size_t totalSize = size * nmemb;
+
+  // Refuse anything past the end of the range, in case the server ignored it and sent the whole file,
+  // and anything from a source whose file isn't the same size as the one being assembled
+  if (segment->received + (curl_off_t)totalSize > segment->length) return 0;
+  if (segment->headers.totalSize != segment->download->partial.size) return 0;
+  segment->file.write(static_cast<const char *>(contents), totalSize);
+  if (!segment->file) return 0;
+  segment->received += totalSize;
+  segment->crc = lzma_crc64(static_cast<const uint8_t *>(contents), totalSize, segment->crc);
+
+  if (segment->download->trackProgress) countTransfer(segment->download->progress, totalSize);
+  segment->download->unrecorded += totalSize;
+  if (segment->download->unrecorded >= DOWNLOAD_SEGMENT_RECORD_INTERVAL) recordSegmentedDownload(*segment->download);
+
+  return totalSize;
+
+}
+
+// Downloads a large file as several byte ranges over parallel connections, returns true if successful
+// The file comes from the first of the given sources that responds, other sources take over segments which fail or stall
+// Falls back to a regular download if the server doesn't support ranges or the file is small
+// An interrupted download keeps its progress, and continues from there on the next attempt
+// Each segment computes the CRC64 of its range as it arrives, which are joined into that of the file for `checksum` (if given)
+bool ToolsCURL::downloadFileSegmented (const std::vector<std::string> &urls, const std::filesystem::path outputPath, Priority priority, uint64_t *checksum) {
+
+  if (DOWNLOAD_SEGMENTS < 2) return downloadResumable(urls, outputPath, priority, 0, nullptr, checksum);
+
+  // Find out where the file actually is, how large it is, and whether it can be fetched in ranges
+  responseHeaders probe;
+  std::string effectiveURL;
+  curl_off_t size = -1;
+  size_t primary = 0;
+
+  for (; primary < urls.size(); primary ++) {
+
+    CURL *curl = acquireHandle();
+    if (!curl) return downloadResumable(urls, outputPath, priority, 0, nullptr, checksum);
+
+    curl_easy_setopt(curl, CURLOPT_URL, urls[primary].c_str());
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &probe);
+
+    const CURLcode result = performTransfer(curl, priority);
+    if (result == CURLE_OK) {
+      char *finalURL = nullptr;
+      curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &finalURL);
+      if (finalURL) effectiveURL = finalURL;
+      curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &size);
+    }
+    if (urls.size() > 1) recordSource(curl, urls[primary], result, probe.status, false);
+    releaseHandle(curl);
+
+    // Only move on to the next source if this one is unreachable
+    if (result == CURLE_OK && probe.status < 400) break;
+    probe = responseHeaders();
+    effectiveURL.clear();
+
+  }
+
+  if (probe.status != 200 || !probe.acceptsRanges || size < DOWNLOAD_SEGMENT_MIN_SIZE || effectiveURL.empty()) {
+    return downloadResumable(urls, outputPath, priority, 0, nullptr, checksum);
+  }
+
+  const std::string &url = urls[primary];
+
+  segmentedDownload download;
+  download.outputPath = outputPath;
+  download.trackProgress = priority == PRIORITY_INSTALL;
+  download.partial.url = url;
+  download.partial.validator = getValidator(probe);
+  download.partial.size = size;
+
+  const std::filesystem::path partPath = getPartPath(outputPath);
+  std::error_code error;
+
+  // Pick up where an earlier attempt left off, as long as the file hasn't changed on the server since
+  // Parts received from another source can only be checked by their size
+  partialDownload previous;
+  const bool unchanged = !download.partial.validator.empty() && readPartialDownload(outputPath, previous) && hasSource(urls, previous.url)
+    && (previous.url == url ? previous.validator == download.partial.validator : previous.size == size);
+
+  // An interrupted single-stream download (such as a prefetch) is quicker to finish than to start over in segments
+  if (unchanged && previous.segments.empty()) return downloadResumable(urls, outputPath, priority, 0, nullptr, checksum);
+
+  bool resume = unchanged && previous.size == size;
+  if (resume) {
+    const uintmax_t partSize = std::filesystem::file_size(partPath, error);
+    resume = !error && partSize == (uintmax_t)size;
+  }
+
+  if (resume) {
+
+    download.segments = std::vector<downloadSegment>(previous.segments.size());
+    curl_off_t received = 0;
+    for (size_t i = 0; i < previous.segments.size(); i ++) {
+      download.segments[i].start = previous.segments[i][0];
+      download.segments[i].length = previous.segments[i][1];
+      download.segments[i].received = previous.segments[i][2];
+      download.segments[i].crc = getFileCRC64(partPath, previous.segments[i][0], previous.segments[i][2]);
+      received += previous.segments[i][2];
+    }
+    LOGFILE << "[I] Resuming download of \"" << url << "\" at " << (received >> 10) << " of " << (size >> 10) << " KiB in "
+      << download.segments.size() << " segments" << std::endl;
+
+  } else {
+
+    ToolsCURL::discardPartial(outputPath);
+
+    // Allocate the whole file up front, so that every segment can write straight into its place
+#ifndef TARGET_WINDOWS
+    int fd = open(partPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    const bool allocated = fd != -1 && posix_fallocate(fd, 0, size) == 0;
+    if (fd != -1) close(fd);
+    if (!allocated) std::filesystem::resize_file(partPath, size, error);
+#else
+    std::ofstream(partPath, std::ios::binary).close();
+    std::filesystem::resize_file(partPath, size, error);
+#endif
+    if (error || std::filesystem::file_size(partPath, error) != (uintmax_t)size) {
+      LOGFILE << "[W] Failed to allocate " << partPath << ", downloading it in one piece" << std::endl;
+      ToolsCURL::discardPartial(outputPath);
+      return downloadResumable(urls, outputPath, priority, 0, nullptr, checksum, &download.progress);
+    }
+
+    // Split the file into equal ranges, no smaller than half the minimum size
+    const curl_off_t segmentCount = std::min<curl_off_t>(DOWNLOAD_SEGMENTS, std::max<curl_off_t>(1, size / (DOWNLOAD_SEGMENT_MIN_SIZE / 2)));
+    const curl_off_t segmentSize = (size + segmentCount - 1) / segmentCount;
+
+    download.segments = std::vector<downloadSegment>(segmentCount);
+    for (curl_off_t i = 0; i < segmentCount; i ++) {
+      download.segments[i].start = i * segmentSize;
+      download.segments[i].length = std::min(segmentSize, size - download.segments[i].start);
+    }
+    LOGFILE << "[I] Downloading \"" << url << "\" (" << (size >> 10) << " KiB) in " << segmentCount << " segments" << std::endl;
+
+  }
+
+  for (downloadSegment &segment : download.segments) {
+    segment.download = &download;
+    segment.source = primary;
+    segment.file.open(partPath, std::ios::in | std::ios::out | std::ios::binary);
+    segment.file.seekp(segment.start + segment.received);
+    if (!segment.file) {
+      LOGFILE << "[W] Failed to open " << partPath << " for writing, downloading it in one piece" << std::endl;
+      download.segments.clear();
+      ToolsCURL::discardPartial(outputPath);
+      return downloadResumable(urls, outputPath, priority, 0, nullptr, checksum, &download.progress);
+    }
+  }
+
+  if (download.trackProgress) {
+    curl_off_t remaining = 0;
+    for (const downloadSegment &segment : download.segments) remaining += segment.length - segment.received;
+    expectTransfer(download.progress, remaining);
+  }
+
+  // Ranges are only served if the file is still the one that was probed
+  // Other sources can't check that, so their responses have to match its size instead
+  struct curl_slist *requestHeaders = nullptr;
+  if (!download.partial.validator.empty()) {
+    requestHeaders = curl_slist_append(requestHeaders, ("If-Range: " + download.partial.validator).c_str());
+  }
+
+  // Incomplete segments are retried from where they left off, with each source getting a turn
+  const size_t attempts = urls.size() + 2;
+  for (size_t attempt = 0; attempt < attempts; attempt ++) {
+
+    std::vector<CURL*> handles;
+    std::vector<downloadSegment*> pending;
+    std::vector<std::string> ranges;
+    ranges.reserve(download.segments.size());
+
+    for (downloadSegment &segment : download.segments) {
+      if (segment.received == segment.length || segment.failed) continue;
+
+      CURL *segmentCurl = acquireHandle();
+      if (!segmentCurl) break;
+
+      segment.headers = responseHeaders();
+      ranges.push_back(std::to_string(segment.start + segment.received) + "-" + std::to_string(segment.start + segment.length - 1));
+      curl_easy_setopt(segmentCurl, CURLOPT_URL, segment.source == primary ? effectiveURL.c_str() : urls[segment.source].c_str());
+      curl_easy_setopt(segmentCurl, CURLOPT_RANGE, ranges.back().c_str());
+      if (segment.source == primary) curl_easy_setopt(segmentCurl, CURLOPT_HTTPHEADER, requestHeaders);
+      curl_easy_setopt(segmentCurl, CURLOPT_WRITEFUNCTION, curlSegmentWriteCallback);
+      curl_easy_setopt(segmentCurl, CURLOPT_WRITEDATA, &segment);
+      curl_easy_setopt(segmentCurl, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+      curl_easy_setopt(segmentCurl, CURLOPT_HEADERDATA, &segment.headers);
+      // Each segment gets a TCP connection of its own, multiplexing them over one would defeat the purpose
+      curl_easy_setopt(segmentCurl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+      curl_easy_setopt(segmentCurl, CURLOPT_PIPEWAIT, 0L);
+      if (urls.size() > 1) abortOnStall(segmentCurl);
+
+      handles.push_back(segmentCurl);
+      pending.push_back(&segment);
+    }
+
+    if (handles.empty()) break;
+
+    const std::vector<CURLcode> results = performTransfers(handles, priority);
+    for (size_t i = 0; i < handles.size(); i ++) {
+      downloadSegment *segment = pending[i];
+      const std::string &segmentURL = urls[segment->source];
+      long segmentResponse = 0;
+      curl_easy_getinfo(handles[i], CURLINFO_RESPONSE_CODE, &segmentResponse);
+      const bool mismatch = segmentResponse == 206 && segment->headers.totalSize != size;
+      if (urls.size() > 1) recordSource(handles[i], segmentURL, mismatch ? CURLE_RANGE_ERROR : results[i], segmentResponse, false);
+      releaseHandle(handles[i]);
+
+      if (results[i] == CURLE_OK && segmentResponse == 206) continue;
+      LOGFILE << "[W] Segment at " << segment->start << " of \"" << segmentURL << "\" failed: "
+        << (mismatch ? "file size differs" : results[i] != CURLE_OK ? curl_easy_strerror(results[i]) : "HTTP " + std::to_string(segmentResponse)) << std::endl;
+
+      // Anything other than a partial response from the probed source means the range wasn't honored, and the data can't be trusted
+      // A source without the file, or one that stalled, just hands the segment over to the next
+      if (segment->source == primary && (mismatch || (segmentResponse != 206 && segmentResponse != 0))) segment->failed = true;
+      else if (urls.size() > 1) segment->source = (segment->source + 1) % urls.size();
+    }
+
+  }
+
+  curl_slist_free_all(requestHeaders);
+  ToolsMirror::saveStats();
+
+  bool complete = true, failed = false;
+  for (downloadSegment &segment : download.segments) {
+    if (segment.failed) failed = true;
+    else if (segment.received != segment.length) complete = false;
+  }
+
+  // If the server stopped honoring ranges, or the file changed, the progress is worthless
+  if (failed) {
+    download.segments.clear();
+    ToolsCURL::discardPartial(outputPath);
+    LOGFILE << "[W] Segmented download of \"" << url << "\" failed, downloading it in one piece" << std::endl;
+    return downloadResumable(urls, outputPath, priority, 0, nullptr, checksum, &download.progress);
+  }
+
+  // Otherwise, the connection is the problem, so keep what has arrived for the next attempt
+  if (!complete) {
+    recordSegmentedDownload(download);
+    download.segments.clear();
+    LOGFILE << "[E] Failed to download file from \"" << url << "\", kept the received segments to resume from" << std::endl;
+    return false;
+  }
+
+  if (checksum) {
+    *checksum = download.segments[0].crc;
+    for (size_t i = 1; i < download.segments.size(); i ++) {
+      *checksum = combineCRC64(*checksum, download.segments[i].crc, download.segments[i].length);
+    }
+  }
+
+  download.segments.clear();
+  return promotePartial(outputPath);
+
+}
+
+// Creates a pipe which holds at most `capacity` bytes at a time
+ToolsCURL::DownloadPipe::DownloadPipe (size_t capacity) : buffer(capacity) {}
+
+// Appends data to the pipe, blocking while it's full. Returns false if the reader gave up
+bool ToolsCURL::DownloadPipe::write (const char *data, size_t size) {
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  const size_t capacity = this->buffer.size();
+
+  while (size > 0) {
+    // Wait for the reader to free up some space
+    this->update.wait(lock, [this, capacity]() { return this->length < capacity || this->aborted; });
+    if (this->aborted) return false;
+
+    // Copy as much as fits, in up to two spans as it wraps around the end of the ring buffer
+    const size_t count = std::min(size, capacity - this->length);
+    const size_t end = (this->start + this->length) % capacity;
+    const size_t first = std::min(count, capacity - end);
+    std::memcpy(this->buffer.data() + end, data, first);
+    std::memcpy(this->buffer.data(), data + first, count - first);
+    this->length += count;
+    data += count;
+    size -= count;
+
+    this->update.notify_all();
+  }
+
+  return true;
+
+}
+
+// Reads up to `size` bytes from the pipe, blocking until data arrives. Returns 0 once the pipe is drained and closed
+size_t ToolsCURL::DownloadPipe::read (char *data, size_t size) {
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  const size_t capacity = this->buffer.size();
+
+  // Wait for the writer to provide data or finish
+  this->update.wait(lock, [this]() { return this->length > 0 || this->closed || this->aborted; });
+  if (this->length == 0) return 0;
+
+  // Copy in up to two spans, as the data may wrap around the end of the ring buffer
+  const size_t count = std::min(size, this->length);
+  const size_t first = std::min(count, capacity - this->start);
+  std::memcpy(data, this->buffer.data() + this->start, first);
+  std::memcpy(data + first, this->buffer.data(), count - first);
+  this->start = (this->start + count) % capacity;
+  this->length -= count;
+
+  this->update.notify_all();
+  return count;
+
+}
+
+// Marks the end of the written data, indicating whether the download succeeded
+void ToolsCURL::DownloadPipe::close (bool success) {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->closed = true;
+  this->success = success;
+  this->update.notify_all();
+}
+
+// Called by the reader to stop the writer early
+void ToolsCURL::DownloadPipe::abort () {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  this->aborted = true;
+  this->update.notify_all();
+}
+
+// Returns true if the writer closed the pipe after a failed download
+bool ToolsCURL::DownloadPipe::failed () {
+  std::lock_guard<std::mutex> lock(this->mutex);
+  return this->closed && !this->success;
+}
+
+// Destination of a piped download, with an optional cache file to fill along the way
+struct pipeWriteTarget {
+  ToolsCURL::DownloadPipe *pipe;
+  std::ofstream *cacheFile;
+  responseHeaders headers;
+  // Bytes handed to the pipe before the current request, and in total
+  curl_off_t start = 0;
+  curl_off_t offset = 0;
+  // Size which a source other than the one the data came from has to report for its data to fit (-1 to skip the check)
+  curl_off_t expectedSize = -1;
+  // Set if the reader stopped listening, as opposed to the download failing
+  bool aborted = false;
+  // Set if the server sent the whole file again after part of it had already been piped
+  bool restarted = false;
+  // Set if a source other than the one the data came from turned out to have a different file
+  bool mismatch = false;
+  // CRC64 of everything handed to the pipe so far
+  uint64_t crc = 0;
+};
+
+// CURL write callback function for writing to a pipe (and cache file)
+size_t curlPipeWriteCallback (void *contents, size_t size, size_t nmemb, void *userp) {
+  pipeWriteTarget *target = static_cast<pipeWriteTarget *>(userp);
+  size_t totalSize = size * nmemb;
+  // Error pages aren't package data
+  if (target->headers.status >= 400) return totalSize;
+  // The piped part belonged to a different version of the file, which can't be taken back out of the pipe
+  if (target->start > 0 && target->headers.status == 200) {
+    target->restarted = true;
+    return 0;
+  }
+  if (target->start > 0 && target->expectedSize > 0 && target->headers.totalSize != target->expectedSize) {
+    target->mismatch = true;
+    return 0;
+  }
+  if (target->cacheFile && !target->cacheFile->write(static_cast<const char *>(contents), totalSize)) {
+    // The pipe doesn't need the cache file, so carry on without it rather than ever promoting an incomplete one
+    LOGFILE << "[W] Failed to write to the cache file, the download won't be cached" << std::endl;
+    target->cacheFile = nullptr;
+  }
+  // Returning 0 makes CURL abort the transfer if the reader is no longer listening
+  if (!target->pipe->write(static_cast<const char *>(contents), totalSize)) {
+    target->aborted = true;
+    return 0;
+  }
+  target->offset += totalSize;
+  target->crc = lzma_crc64(static_cast<const uint8_t *>(contents), totalSize, target->crc);
+  return totalSize;
+}
+
+// Downloads a file from the first of the specified URLs that works into a pipe, optionally also writing it to the given cache path
+// The cache file is written as a .part file until it's complete. If an earlier attempt was interrupted,
+// the part it left behind is replayed into the pipe and the download continues from its end.
+// If a source fails or stalls partway, the next one continues from where it left off
+// The CRC64 of the file is computed as it passes through, and written to `checksum` (if given) once it's complete
+bool ToolsCURL::downloadToPipe (const std::vector<std::string> &urls, DownloadPipe &pipe, const std::filesystem::path cachePath, uint64_t *checksum) {
+
+  std::ofstream cacheFile;
+  partialDownload partial;
+  curl_off_t offset = 0;
+  uint64_t crc = 0;
+
+  if (!cachePath.empty()) {
+
+    offset = getResumeOffset(urls, cachePath, partial);
+
+    if (offset > 0) {
+      LOGFILE << "[I] Resuming stream of \"" << partial.url << "\" at " << (offset >> 10) << " KiB" << std::endl;
+
+      std::ifstream partFile(getPartPath(cachePath), std::ios::binary);
+      std::vector<char> buffer(1 << 20);
+      curl_off_t replayed = 0;
+
+      while (replayed < offset) {
+        partFile.read(buffer.data(), std::min<curl_off_t>(buffer.size(), offset - replayed));
+        if (partFile.gcount() <= 0) break;
+        // The extractor gave up on the data received so far, so it isn't worth resuming
+        if (!pipe.write(buffer.data(), partFile.gcount())) break;
+        crc = lzma_crc64(reinterpret_cast<const uint8_t*>(buffer.data()), partFile.gcount(), crc);
+        replayed += partFile.gcount();
+      }
+
+      if (replayed != offset) {
+        LOGFILE << "[E] Failed to replay the received part of \"" << partial.url << "\"" << std::endl;
+        ToolsCURL::discardPartial(cachePath);
+        pipe.close(false);
+        return false;
+      }
+    }
+
+    cacheFile.open(getPartPath(cachePath), std::ios::binary | (offset > 0 ? std::ios::app : std::ios::trunc));
+    if (!cacheFile.is_open()) {
+      LOGFILE << "[W] Failed to open cache file for writing: " << getPartPath(cachePath) << std::endl;
+    }
+
+  }
+
+  pipeWriteTarget target;
+  target.pipe = &pipe;
+  target.cacheFile = cacheFile.is_open() ? &cacheFile : nullptr;
+  target.offset = offset;
+  target.crc = crc;
+  transferProgress progress;
+
+  bool success = false;
+  // Set if the source which the piped data came from no longer has the file
+  bool gone = false;
+
+  for (size_t source = 0; source < urls.size() && !success && !gone && !target.aborted; source ++) {
+
+    const std::string &url = urls[source];
+
+    // Other sources can't check the piped data against their version of the file, so the size has to do
+    const bool sameSource = target.offset == 0 || partial.url == url;
+    if (!sameSource && partial.size <= 0) continue;
+
+    // Take a CURL handle from the pool
+    CURL *curl = acquireHandle();
+
+    if (!curl) {
+      LOGFILE << "[E] Failed to initialize CURL" << std::endl;
+      break;
+    }
+
+    target.headers = responseHeaders();
+    target.start = target.offset;
+    target.expectedSize = sameSource ? -1 : partial.size;
+    target.restarted = false;
+    target.mismatch = false;
+
+    // Set request parameters
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlPipeWriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &target);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &target.headers);
+    if (source + 1 < urls.size()) abortOnStall(curl);
+    restartTransfer(progress);
+    trackProgress(curl, progress, PRIORITY_INSTALL);
+
+    // Only ask for the missing bytes, unless the file has changed since
+    const std::string range = std::to_string(target.offset) + "-";
+    struct curl_slist *requestHeaders = nullptr;
+    if (target.offset > 0) {
+      if (sameSource) {
+        requestHeaders = curl_slist_append(requestHeaders, ("If-Range: " + partial.validator).c_str());
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, requestHeaders);
+      } else {
+        LOGFILE << "[I] Continuing stream of \"" << partial.url << "\" from \"" << url << "\" at " << (target.offset >> 10) << " KiB" << std::endl;
+      }
+      curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+    }
+
+    // The write callback blocks while the pipe is full, so this runs on the calling thread rather than the transfer thread
+    CURLcode response = performExternalTransfer(curl, progress, PRIORITY_INSTALL);
+    const long status = target.headers.status;
+    if (urls.size() > 1) recordSource(curl, url, target.mismatch || target.restarted ? CURLE_RANGE_ERROR : response, status, true);
+
+    // Return the handle to the pool
+    releaseHandle(curl);
+    curl_slist_free_all(requestHeaders);
+
+    // The source that sent the file from the start is the one to check the rest against
+    if (status == 200 && target.start == 0) adoptSource(partial, url, target.headers);
+
+    if (response == CURLE_OK && status < 400) {
+      success = true;
+    } else if (target.restarted && sameSource) {
+      LOGFILE << "[E] \"" << url << "\" changed since its download was interrupted" << std::endl;
+      gone = true;
+    } else if (target.restarted || target.mismatch) {
+      LOGFILE << "[W] \"" << url << "\" has a different file than \"" << partial.url << "\", skipping it" << std::endl;
+    } else if (response == CURLE_OK) {
+      LOGFILE << "[E] Failed to stream file from \"" << url << "\": HTTP " << status << std::endl;
+      gone = sameSource && urls.size() == 1;
+    } else {
+      LOGFILE << "[E] Failed to stream file from \"" << url << "\": " << curl_easy_strerror(response) << std::endl;
+    }
+
+  }
+
+  ToolsMirror::saveStats();
+  cacheFile.close();
+  const bool cached = target.cacheFile && !cacheFile.fail();
+
+  if (!success) {
+    // An archive which the extractor rejected isn't worth resuming, but an interrupted download is
+    if (!cachePath.empty()) {
+      if (gone || target.aborted || !cached) ToolsCURL::discardPartial(cachePath);
+      else keepPartial(cachePath, partial);
+    }
+    pipe.close(false);
     return false;
   }
 
+  if (cached) promotePartial(cachePath);
+  else if (!cachePath.empty()) ToolsCURL::discardPartial(cachePath);
+  if (checksum) *checksum = target.crc;
+
+  pipe.close(true);
   return true;
 
 }
 
 // Downloads and returns a string from the given URL
-std::string ToolsCURL::downloadString (const std::string &url) {
+std::string ToolsCURL::downloadString (const std::string &url, Priority priority) {
 
-  // Initialize CURL
-  CURL *curl = curl_easy_init();
+  // Take a CURL handle from the pool
+  CURL *curl = acquireHandle();
 
   if (!curl) {
     LOGFILE << "[E] Failed to initialize CURL" << std::endl;
@@ -93,11 +1653,14 @@ std::string ToolsCURL::downloadString (const std::string &url) {
   curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlStringWriteCallback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
-  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  curl_easy_setopt(curl, CURLOPT_USERAGENT, "spplice/3.0");
+  // Text compresses well, so accept any encoding CURL can decode
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 
   // Perform the request
-  CURLcode response = curl_easy_perform(curl);
+  CURLcode response = performTransfer(curl, priority);
+
+  // Return the handle to the pool
+  releaseHandle(curl);
 
   // Check for errors
   if (response != CURLE_OK) {
@@ -105,13 +1668,65 @@ std::string ToolsCURL::downloadString (const std::string &url) {
     return "";
   }
 
-  // Clean up CURL
-  curl_easy_cleanup(curl);
-
   return readBuffer;
 
 }
 
+// Downloads a string from the given URL only if it differs from the copy identified by the given validators
+// Returns the HTTP status: 200 updates the content and validators, 304 means the copy is still current, anything else is a failure
+long ToolsCURL::revalidateString (const std::string &url, std::string &content, std::string &etag, std::string &lastModified, Priority priority) {
+
+  // Take a CURL handle from the pool
+  CURL *curl = acquireHandle();
+
+  if (!curl) {
+    LOGFILE << "[E] Failed to initialize CURL" << std::endl;
+    return 0;
+  }
+
+  std::string readBuffer;
+  responseHeaders headers;
+
+  // Set request parameters
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlStringWriteCallback);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &readBuffer);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeaderCallback);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headers);
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+
+  // Let the server skip the body if our copy is still current
+  struct curl_slist *requestHeaders = nullptr;
+  if (!etag.empty()) requestHeaders = curl_slist_append(requestHeaders, ("If-None-Match: " + etag).c_str());
+  if (!lastModified.empty()) requestHeaders = curl_slist_append(requestHeaders, ("If-Modified-Since: " + lastModified).c_str());
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, requestHeaders);
+
+  // Perform the request
+  CURLcode response = performTransfer(curl, priority);
+
+  // Return the handle to the pool
+  releaseHandle(curl);
+  curl_slist_free_all(requestHeaders);
+
+  // Check for errors
+  if (response != CURLE_OK) {
+    LOGFILE << "[E] Failed to download string from \"" << url << "\": " << curl_easy_strerror(response) << std::endl;
+    return 0;
+  }
+  if (headers.status != 200 && headers.status != 304) {
+    LOGFILE << "[E] Failed to download string from \"" << url << "\": HTTP " << headers.status << std::endl;
+    return headers.status;
+  }
+
+  if (headers.status == 200) {
+    content = readBuffer;
+    etag = headers.etag;
+    lastModified = headers.lastModified;
+  }
+  return headers.status;
+
+}
+
 // Creates a WebSocket connection, returns the respective CURL handle
 CURL* ToolsCURL::wsConnect (const std::string &url) {
 
@@ -125,6 +1740,7 @@ CURL* ToolsCURL::wsConnect (const std::string &url) {
 
   curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
   curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 2L);
+  curl_easy_setopt(curl, CURLOPT_SHARE, curlShare);
 
   // Perform the request
   CURLcode response = curl_easy_perform(curl);
@@ -2,6 +2,11 @@
 #define TOOLS_CURL_H
 
 #include <filesystem>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
 
 #ifndef TARGET_WINDOWS
   #include "../deps/linux/include/curl/curl.h"
@@ -11,11 +16,44 @@
 
 class ToolsCURL {
   public:
+
+    // A bounded buffer which hands downloaded data to another thread as it arrives
+    class DownloadPipe {
+      public:
+        DownloadPipe (size_t capacity);
+        bool write (const char *data, size_t size);
+        size_t read (char *data, size_t size);
+        void close (bool success);
+        void abort ();
+        bool failed ();
+
+      private:
+        std::vector<char> buffer;
+        size_t start = 0;
+        size_t length = 0;
+        bool closed = false;
+        bool aborted = false;
+        bool success = true;
+        std::mutex mutex;
+        std::condition_variable update;
+    };
+
+    // Transfer classes, most important first. Less important transfers are held back while more important ones run
+    enum Priority { PRIORITY_INSTALL, PRIORITY_INDEX, PRIORITY_ICON, PRIORITY_PREFETCH, PRIORITY_COUNT };
+
     static void init ();
     static void cleanup ();
+    static void preconnect (const std::string &url);
 
-    static bool downloadFile (const std::string &url, const std::filesystem::path outputPath);
-    static std::string downloadString (const std::string &url);
+    static bool downloadFile (const std::string &url, const std::filesystem::path outputPath, Priority priority = PRIORITY_INSTALL);
+    static bool downloadFileSegmented (const std::vector<std::string> &urls, const std::filesystem::path outputPath, Priority priority = PRIORITY_INSTALL, uint64_t *checksum = nullptr);
+    static bool prefetchFile (const std::vector<std::string> &urls, const std::filesystem::path outputPath, curl_off_t maxSize, const std::atomic<bool> &cancel, uint64_t *checksum = nullptr);
+    static void cancelTransfers (std::atomic<bool> &cancel);
+    static void discardPartial (const std::filesystem::path outputPath);
+    static bool downloadToPipe (const std::vector<std::string> &urls, DownloadPipe &pipe, const std::filesystem::path cachePath = std::filesystem::path(), uint64_t *checksum = nullptr);
+    static std::string downloadString (const std::string &url, Priority priority = PRIORITY_INDEX);
+    static long revalidateString (const std::string &url, std::string &content, std::string &etag, std::string &lastModified, Priority priority = PRIORITY_INDEX);
+    static std::vector<double> probeLatency (const std::vector<std::string> &urls, long timeout);
 
     static CURL* wsConnect (const std::string &url);
     static void wsDisconnect (CURL *curl);
@@ -0,0 +1,972 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+
+#include "../globals.h" // Project globals
+#include "progress.h" // ToolsProgress
+
+#ifdef TARGET_WINDOWS
+  #include "../deps/win32/include/archive.h"
+  #include "../deps/win32/include/archive_entry.h"
+  #include "../deps/win32/include/lzma.h"
+
+  #include <windows.h>
+#else
+  #include <archive.h>
+  #include <archive_entry.h>
+  #include <lzma.h>
+  #include <zstd.h>
+
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+// Definitions for this source file
+#include "extract.h"
+
+// Holds a read-only memory mapping of an entire file
+struct mappedFile {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+#ifdef TARGET_WINDOWS
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+
+  ~mappedFile () {
+#ifndef TARGET_WINDOWS
+    if (this->data) munmap(const_cast<uint8_t*>(this->data), this->size);
+#else
+    if (this->data) UnmapViewOfFile(this->data);
+    if (this->mapping) CloseHandle(this->mapping);
+    if (this->file != INVALID_HANDLE_VALUE) CloseHandle(this->file);
+#endif
+  }
+};
+
+// Maps the given file into memory and advises the kernel that it'll be read sequentially
+bool mapFile (mappedFile &mapped, const std::filesystem::path path) {
+
+#ifndef TARGET_WINDOWS
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) return false;
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+
+  madvise(data, fileStat.st_size, MADV_SEQUENTIAL);
+
+  mapped.data = static_cast<const uint8_t*>(data);
+  mapped.size = fileStat.st_size;
+#else
+  mapped.file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (mapped.file == INVALID_HANDLE_VALUE) return false;
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(mapped.file, &fileSize) || fileSize.QuadPart == 0) return false;
+
+  mapped.mapping = CreateFileMappingW(mapped.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!mapped.mapping) return false;
+
+  const void *data = MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!data) return false;
+
+  mapped.data = static_cast<const uint8_t*>(data);
+  mapped.size = fileSize.QuadPart;
+#endif
+
+  return true;
+
+}
+
+// Decodes the index of a single-stream xz file, returns nullptr if that's not possible
+// The returned index has to be freed with lzma_index_end
+lzma_index* decodeXZIndex (const uint8_t *data, size_t size) {
+
+  if (size < 2 * LZMA_STREAM_HEADER_SIZE) return nullptr;
+
+  // Check for the xz stream header magic bytes
+  lzma_stream_flags headerFlags;
+  if (lzma_stream_header_decode(&headerFlags, data) != LZMA_OK) return nullptr;
+
+  // Decode the stream footer, which tells us where the index begins
+  const size_t footerOffset = size - LZMA_STREAM_HEADER_SIZE;
+  lzma_stream_flags footerFlags;
+  if (lzma_stream_footer_decode(&footerFlags, data + footerOffset) != LZMA_OK) return nullptr;
+  if (footerFlags.backward_size > footerOffset) return nullptr;
+
+  // Decode the index, which lists every block in the stream
+  lzma_index *index = nullptr;
+  uint64_t memlimit = UINT64_MAX;
+  size_t indexPosition = 0;
+  if (lzma_index_buffer_decode(&index, &memlimit, nullptr, data + footerOffset - footerFlags.backward_size, &indexPosition, footerFlags.backward_size) != LZMA_OK) {
+    return nullptr;
+  }
+
+  return index;
+
+}
+
+// Returns the number of blocks in a single-stream xz file, or 0 if that can't be determined
+uint64_t countXZBlocks (const uint8_t *data, size_t size) {
+
+  lzma_index *index = decodeXZIndex(data, size);
+  if (!index) return 0;
+
+  const uint64_t blocks = lzma_index_block_count(index);
+  lzma_index_end(index, nullptr);
+
+  return blocks;
+
+}
+
+// Number of multi-block xz archives being decoded right now, which split the CPU cores between them
+std::atomic<uint32_t> xzDecodersActive(0);
+
+// Holds the state of a multi-threaded xz decoder which feeds libarchive
+struct xzDecoderState {
+  // liblzma decoder stream, reading straight from the mapped input file
+  lzma_stream stream = LZMA_STREAM_INIT;
+  // Set once the decoder reports the end of the stream
+  bool finished = false;
+  // Set while this archive counts towards xzDecodersActive
+  bool counted = false;
+  // Buffer for decompressed output
+  std::vector<uint8_t> outBuffer = std::vector<uint8_t>(1 << 20);
+
+  ~xzDecoderState () {
+    lzma_end(&this->stream);
+    if (this->counted) xzDecodersActive --;
+  }
+};
+
+// Sets up a multi-threaded xz decoder for the given mapped file
+bool xzDecoderOpen (xzDecoderState &state, const mappedFile &input, uint32_t threads) {
+
+  lzma_mt options = {};
+  options.threads = threads;
+  options.flags = LZMA_CONCATENATED;
+  // Fall back to single-threaded decoding rather than using more than a quarter of RAM
+  options.memlimit_threading = std::max<uint64_t>(lzma_physmem() / 4, 64 << 20);
+  options.memlimit_stop = UINT64_MAX;
+
+  lzma_ret result = lzma_stream_decoder_mt(&state.stream, &options);
+  if (result != LZMA_OK) {
+    LOGFILE << "[W] Failed to initialize multi-threaded xz decoder: error " << result << std::endl;
+    return false;
+  }
+
+  // The whole file is available up front
+  state.stream.next_in = input.data;
+  state.stream.avail_in = input.size;
+  return true;
+
+}
+
+// libarchive read callback, returns the next chunk of decompressed data
+la_ssize_t xzDecoderRead (struct archive *archive, void *data, const void **buffer) {
+
+  xzDecoderState *state = static_cast<xzDecoderState*>(data);
+  lzma_stream &stream = state->stream;
+
+  *buffer = state->outBuffer.data();
+  if (state->finished) return 0;
+
+  stream.next_out = state->outBuffer.data();
+  stream.avail_out = state->outBuffer.size();
+
+  // Keep decoding until at least some output has been produced
+  while (stream.avail_out == state->outBuffer.size()) {
+
+    lzma_ret result = lzma_code(&stream, LZMA_FINISH);
+    if (result == LZMA_STREAM_END) {
+      state->finished = true;
+      break;
+    }
+    if (result != LZMA_OK) {
+      archive_set_error(archive, EINVAL, "xz decoder error %d", (int)result);
+      return ARCHIVE_FATAL;
+    }
+
+  }
+
+  return state->outBuffer.size() - stream.avail_out;
+
+}
+
+// Holds everything an archive opened by openLocalArchive reads from
+struct localArchiveState {
+  mappedFile mapping;
+  xzDecoderState xz;
+};
+
+// Returns true if the given leading bytes are the magic bytes of a supported package archive format
+bool ToolsExtract::isPackageArchive (const std::string &magic) {
+
+  // xz stream header
+  if (magic.compare(0, 6, std::string("\xFD" "7zXZ\0", 6)) == 0) return true;
+  // zstd frame header
+  if (magic.compare(0, 4, "\x28\xB5\x2F\xFD") == 0) return true;
+
+  return false;
+
+}
+
+// Returns true if the file starts with the magic bytes of a supported package archive format
+bool ToolsExtract::isPackageArchive (const std::filesystem::path path) {
+
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return false;
+
+  char magic[6];
+  file.read(magic, sizeof(magic));
+  return ToolsExtract::isPackageArchive(std::string(magic, file.gcount()));
+
+}
+
+// Returns the normalized path of an archive entry, without any leading "./"
+std::string getMemberName (struct archive_entry* entry) {
+  return std::filesystem::path(archive_entry_pathname(entry)).lexically_normal().generic_string();
+}
+
+// A decoded archive entry waiting to be written to disk
+struct extractJob {
+  struct archive_entry* entry;
+  std::vector<char> data;
+};
+
+// Bounded queue of decoded entries, shared between the decoding thread and the writer threads
+struct extractQueue {
+  std::deque<extractJob> jobs;
+  // Bytes of file data either queued or being written
+  size_t bufferedBytes = 0;
+  // Number of jobs taken off the queue but not yet written
+  int activeJobs = 0;
+  // Set by the decoding thread once no more jobs will be queued
+  bool closed = false;
+  // Set by a writer thread if any entry failed to write
+  bool failed = false;
+  std::mutex mutex;
+  std::condition_variable update;
+};
+
+// Creates a disk writer, which restores entry timestamps like the original single-threaded extractor
+struct archive* createDiskWriter () {
+  struct archive* extracted = archive_write_disk_new();
+  archive_write_disk_set_options(extracted, ARCHIVE_EXTRACT_TIME);
+  return extracted;
+}
+
+// Writes a fully decoded entry to disk, returns true if successful
+bool writeDiskEntry (struct archive* extracted, struct archive_entry* entry, const std::vector<char> &data) {
+
+  bool success = true;
+
+  if (archive_write_header(extracted, entry) < ARCHIVE_WARN) {
+    LOGFILE << "[E] Archive write error: " << archive_error_string(extracted) << std::endl;
+    success = false;
+  } else if (!data.empty() && archive_write_data_block(extracted, data.data(), data.size(), 0) != ARCHIVE_OK) {
+    LOGFILE << "[E] Archive write error: " << archive_error_string(extracted) << std::endl;
+    success = false;
+  }
+  archive_write_finish_entry(extracted);
+
+  return success;
+
+}
+
+// Writer thread loop, writes queued entries to disk until the queue is closed and empty
+void extractWriterLoop (extractQueue &queue, struct archive* extracted) {
+
+  while (true) {
+
+    extractJob job;
+    {
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      queue.update.wait(lock, [&queue]() { return !queue.jobs.empty() || queue.closed; });
+      if (queue.jobs.empty()) return;
+
+      job = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+      queue.activeJobs ++;
+    }
+
+    bool success = writeDiskEntry(extracted, job.entry, job.data);
+    archive_entry_free(job.entry);
+
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.activeJobs --;
+      queue.bufferedBytes -= job.data.size();
+      if (!success) queue.failed = true;
+    }
+    queue.update.notify_all();
+
+  }
+
+}
+
+// Writes every entry of an opened archive to the destination directory, then frees the archive
+// Decoding happens on this thread, while a pool of EXTRACT_WRITERS threads creates the files
+// Files which the given filter finds redundant are left out
+bool extractOpenedArchive (struct archive* archive, const std::filesystem::path dest, const ToolsExtract::EntryFilter *filter) {
+
+  struct archive_entry* entry;
+
+  // Entries larger than this are written straight from the decoding thread, to keep memory bounded
+  const size_t inlineSize = EXTRACT_BUFFER_SIZE / 4;
+
+  // Start the writer threads, each with its own disk writer
+  extractQueue queue;
+  std::vector<struct archive*> writers;
+  std::vector<std::thread> writerThreads;
+  for (int i = 0; i < EXTRACT_WRITERS; i ++) {
+    writers.push_back(createDiskWriter());
+    writerThreads.emplace_back(extractWriterLoop, std::ref(queue), writers.back());
+  }
+
+  // The decoding thread also gets a writer, for directories, large files and links
+  struct archive* extracted = createDiskWriter();
+
+  // Names of the files left out by the filter, and their total size
+  std::unordered_set<std::string> skippedFiles;
+  uintmax_t skippedBytes = 0;
+
+  bool success = true;
+  while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+
+    const std::string name = getMemberName(entry);
+    std::filesystem::path full_path = dest / archive_entry_pathname(entry);
+    archive_entry_set_pathname_utf8(entry, full_path.string().c_str());
+
+    // Hard links point to another entry in the archive, which needs to be relocated too
+    const char* hardlink = archive_entry_hardlink(entry);
+    if (hardlink) {
+      // There's nothing to link to if the target was left out, so leave the link out as well
+      const std::string hardlinkName = std::filesystem::path(hardlink).lexically_normal().generic_string();
+      if (skippedFiles.count(hardlinkName)) {
+        LOGFILE << "[W] Skipped: \"" << name << "\" (links to skipped \"" << hardlinkName << "\")" << std::endl;
+        continue;
+      }
+      std::filesystem::path full_hardlink = dest / hardlink;
+      archive_entry_set_hardlink_utf8(entry, full_hardlink.string().c_str());
+    }
+
+    LOGFILE << "[I] Extracting: " << '"' << archive_entry_pathname(entry) << '"' << std::endl;
+
+    const void* buff;
+    size_t size;
+    la_int64_t offset;
+    int err;
+
+    // Directories are created here too, so that their timestamps are deferred until the final close
+    const la_int64_t entrySize = archive_entry_size(entry);
+    ToolsProgress::add(ToolsProgress::STAGE_EXTRACT, 1, std::max<la_int64_t>(entrySize, 0));
+    const bool isDirectory = archive_entry_filetype(entry) == AE_IFDIR;
+    const bool writeInline = writers.empty() || isDirectory || hardlink || entrySize > (la_int64_t)inlineSize;
+
+    // Only the contents of files matching the filter by name and size get checksummed
+    const bool filterCandidate = filter && !hardlink && archive_entry_filetype(entry) == AE_IFREG
+      && entrySize > 0 && filter->isCandidate(name, entrySize);
+    uint64_t crc = 0;
+
+    if (writeInline) {
+
+      // A hard link target may still be waiting in the queue, so wait for the writers to catch up
+      if (hardlink) {
+        std::unique_lock<std::mutex> lock(queue.mutex);
+        queue.update.wait(lock, [&queue]() { return queue.jobs.empty() && queue.activeJobs == 0; });
+      }
+
+      archive_write_header(extracted, entry);
+
+      while (true) {
+        err = archive_read_data_block(archive, &buff, &size, &offset);
+        if (err == ARCHIVE_EOF) break;
+        if (err != ARCHIVE_OK) {
+          LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
+          success = false;
+          break;
+        }
+        err = archive_write_data_block(extracted, buff, size, offset);
+        if (err != ARCHIVE_OK) {
+          LOGFILE << "[E] Archive write error: " << archive_error_string(extracted) << std::endl;
+          success = false;
+          break;
+        }
+        if (filterCandidate) crc = lzma_crc64(static_cast<const uint8_t*>(buff), size, crc);
+      }
+      archive_write_finish_entry(extracted);
+
+      // Large files are checked as they're written, and removed again if they turn out to be redundant
+      if (success && filterCandidate && filter->isRedundant(name, entrySize, crc)) {
+        std::error_code error;
+        std::filesystem::remove(full_path, error);
+        LOGFILE << "[I] Skipped: \"" << name << "\" (identical to base game)" << std::endl;
+        skippedFiles.insert(name);
+        skippedBytes += entrySize;
+      }
+
+      continue;
+
+    }
+
+    // Decode the whole entry into memory for one of the writer threads
+    extractJob job;
+    job.data.resize(std::max<la_int64_t>(entrySize, 0));
+
+    while (true) {
+      err = archive_read_data_block(archive, &buff, &size, &offset);
+      if (err == ARCHIVE_EOF) break;
+      if (err != ARCHIVE_OK) {
+        LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
+        success = false;
+        break;
+      }
+      if ((size_t)offset + size > job.data.size()) job.data.resize(offset + size);
+      std::copy(static_cast<const char*>(buff), static_cast<const char*>(buff) + size, job.data.begin() + offset);
+    }
+    if (!success) break;
+
+    if (filterCandidate && filter->isRedundant(name, entrySize, lzma_crc64(reinterpret_cast<const uint8_t*>(job.data.data()), job.data.size(), 0))) {
+      LOGFILE << "[I] Skipped: \"" << name << "\" (identical to base game)" << std::endl;
+      skippedFiles.insert(name);
+      skippedBytes += entrySize;
+      continue;
+    }
+
+    job.entry = archive_entry_clone(entry);
+    const size_t jobSize = job.data.size();
+
+    {
+      // Wait until the job fits in the buffer budget
+      std::unique_lock<std::mutex> lock(queue.mutex);
+      queue.update.wait(lock, [&queue, jobSize]() {
+        return queue.bufferedBytes + jobSize <= EXTRACT_BUFFER_SIZE || queue.bufferedBytes == 0 || queue.failed;
+      });
+      if (queue.failed) {
+        archive_entry_free(job.entry);
+        break;
+      }
+      queue.bufferedBytes += jobSize;
+      queue.jobs.push_back(std::move(job));
+    }
+    queue.update.notify_all();
+
+  }
+
+  // Let the writers finish whatever is left in the queue
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.closed = true;
+  }
+  queue.update.notify_all();
+  for (std::thread &thread : writerThreads) thread.join();
+  if (queue.failed) success = false;
+
+  // Free any jobs left behind if a writer failed
+  for (extractJob &job : queue.jobs) archive_entry_free(job.entry);
+
+  archive_read_close(archive);
+  archive_read_free(archive);
+
+  if (!skippedFiles.empty()) {
+    LOGFILE << "[I] Skipped " << skippedFiles.size() << " files (" << (skippedBytes >> 10) << " KiB) identical to the base game" << std::endl;
+  }
+
+  // Closing the writers applies deferred directory timestamps, so only do it once all files exist
+  writers.push_back(extracted);
+  for (struct archive* writer : writers) {
+    archive_write_close(writer);
+    archive_write_free(writer);
+  }
+
+  return success;
+
+}
+
+// Opens a local tar.xz or tar.zst archive for reading, returns nullptr on failure
+// The archive is read from a memory mapping where possible, so the given state must outlive it
+struct archive* openLocalArchive (const std::filesystem::path path, localArchiveState &state) {
+
+  struct archive* archive;
+
+  archive = archive_read_new();
+  archive_read_support_format_tar(archive);
+  archive_read_support_filter_xz(archive);
+  archive_read_support_filter_zstd(archive);
+
+  int openResult;
+  if (mapFile(state.mapping, path)) {
+
+    // Multi-block xz archives get decoded in parallel, everything else goes straight to libarchive
+    // Concurrent extractions (as when merging) each get their share of the cores, not all of them
+    const uint64_t xzBlocks = countXZBlocks(state.mapping.data, state.mapping.size);
+    uint32_t xzThreads = 1;
+    if (xzBlocks > 1) {
+      state.xz.counted = true;
+      const uint32_t decoders = ++xzDecodersActive;
+      xzThreads = std::min<uint64_t>(std::max<uint32_t>(1, std::thread::hardware_concurrency() / decoders), xzBlocks);
+    }
+
+    if (xzThreads > 1 && xzDecoderOpen(state.xz, state.mapping, xzThreads)) {
+      LOGFILE << "[I] Decoding " << xzBlocks << " xz blocks on " << xzThreads << " threads" << std::endl;
+      openResult = archive_read_open(archive, &state.xz, nullptr, xzDecoderRead, nullptr);
+    } else {
+      openResult = archive_read_open_memory(archive, state.mapping.data, state.mapping.size);
+    }
+
+  } else {
+    LOGFILE << "[W] Failed to map " << path << " into memory, reading it instead" << std::endl;
+    openResult = archive_read_open_filename_w(archive, path.wstring().c_str(), 1 << 20);
+  }
+
+  if (openResult != ARCHIVE_OK) {
+    LOGFILE << "[E] Could not open file: " << archive_error_string(archive) << std::endl;
+    archive_read_free(archive);
+    return nullptr;
+  }
+
+  return archive;
+
+}
+
+// Returns the decompressed size of an xz archive as recorded in its index, or 0 if it isn't known
+uintmax_t ToolsExtract::getUncompressedSize (const std::filesystem::path path) {
+
+  mappedFile mapping;
+  if (!mapFile(mapping, path)) return 0;
+
+  lzma_index *index = decodeXZIndex(mapping.data, mapping.size);
+  if (!index) return 0;
+
+  const uintmax_t size = lzma_index_uncompressed_size(index);
+  lzma_index_end(index, nullptr);
+
+  return size;
+
+}
+
+// Extracts a tar.xz or tar.zst archive
+bool ToolsExtract::extractLocalFile (const std::filesystem::path path, const std::filesystem::path dest, const ToolsExtract::EntryFilter *filter) {
+
+  localArchiveState archiveState;
+  struct archive* archive = openLocalArchive(path, archiveState);
+  if (!archive) return false;
+
+  return extractOpenedArchive(archive, dest, filter);
+
+}
+
+// Decodes the whole archive without writing anything, returns true if it's intact and not empty
+bool ToolsExtract::verifyArchive (const std::filesystem::path path) {
+
+  localArchiveState archiveState;
+  struct archive* archive = openLocalArchive(path, archiveState);
+  if (!archive) return false;
+
+  struct archive_entry* entry;
+  const void* buff;
+  size_t size;
+  la_int64_t offset;
+  int entries = 0, result;
+  bool success = true;
+
+  while (success && (result = archive_read_next_header(archive, &entry)) == ARCHIVE_OK) {
+    entries ++;
+    int err;
+    while ((err = archive_read_data_block(archive, &buff, &size, &offset)) == ARCHIVE_OK);
+    if (err != ARCHIVE_EOF) success = false;
+  }
+  if (success && result != ARCHIVE_EOF) success = false;
+
+  if (!success) LOGFILE << "[E] Archive " << path << " is damaged: " << archive_error_string(archive) << std::endl;
+
+  archive_read_close(archive);
+  archive_read_free(archive);
+
+  return success && entries > 0;
+
+}
+
+// Returns the paths of all entries in the given archive
+std::vector<std::string> ToolsExtract::listArchiveEntries (const std::filesystem::path path) {
+
+  std::vector<std::string> entries;
+
+  localArchiveState archiveState;
+  struct archive* archive = openLocalArchive(path, archiveState);
+  if (!archive) return entries;
+
+  struct archive_entry* entry;
+  while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+    entries.push_back(getMemberName(entry));
+  }
+
+  archive_read_close(archive);
+  archive_read_free(archive);
+
+  return entries;
+
+}
+
+// Reads a single named file from the given archive into memory, returns true if successful
+bool ToolsExtract::readArchiveMember (const std::filesystem::path path, const std::string &name, std::string &output) {
+
+  localArchiveState archiveState;
+  struct archive* archive = openLocalArchive(path, archiveState);
+  if (!archive) return false;
+
+  bool found = false;
+  bool success = true;
+
+  struct archive_entry* entry;
+  while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+    if (archive_entry_filetype(entry) != AE_IFREG || getMemberName(entry) != name) continue;
+    found = true;
+
+    output.clear();
+    char buffer[16384];
+    la_ssize_t size;
+    while ((size = archive_read_data(archive, buffer, sizeof(buffer))) > 0) {
+      output.append(buffer, size);
+    }
+    if (size < 0) {
+      LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
+      success = false;
+    }
+    break;
+  }
+
+  archive_read_close(archive);
+  archive_read_free(archive);
+
+  if (!found) LOGFILE << "[E] Archive " << path << " has no member \"" << name << '"' << std::endl;
+  return found && success;
+
+}
+
+// Streams the archive members chosen by the selector to the paths it returns, in a single pass
+// Stops after `limit` members have been written. Returns the number of members written, or -1 on error
+int ToolsExtract::extractArchiveMembers (const std::filesystem::path path, ToolsExtract::MemberSelector selector, int limit) {
+
+  localArchiveState archiveState;
+  struct archive* archive = openLocalArchive(path, archiveState);
+  if (!archive) return -1;
+
+  int written = 0;
+  bool success = true;
+
+  struct archive_entry* entry;
+  while (written != limit && archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
+    if (archive_entry_filetype(entry) != AE_IFREG) continue;
+
+    // Read the first block so that the selector can look at the file's magic bytes
+    const void* buff;
+    size_t size = 0;
+    la_int64_t offset;
+    int err = archive_read_data_block(archive, &buff, &size, &offset);
+    if (err != ARCHIVE_OK && err != ARCHIVE_EOF) {
+      LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
+      success = false;
+      break;
+    }
+
+    const std::string magic = err == ARCHIVE_OK ? std::string(static_cast<const char*>(buff), std::min<size_t>(size, 16)) : "";
+    const std::filesystem::path target = selector(getMemberName(entry), magic);
+    if (target.empty()) continue;
+
+    std::ofstream file(target, std::ios::binary);
+    if (!file.is_open()) {
+      LOGFILE << "[E] Failed to open file for writing: " << target << std::endl;
+      success = false;
+      break;
+    }
+
+    while (err == ARCHIVE_OK) {
+      file.seekp(offset);
+      file.write(static_cast<const char*>(buff), size);
+      err = archive_read_data_block(archive, &buff, &size, &offset);
+    }
+    if (err != ARCHIVE_EOF) {
+      LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
+      success = false;
+      break;
+    }
+
+    LOGFILE << "[I] Extracted " << '"' << getMemberName(entry) << '"' << " to " << target << std::endl;
+    written ++;
+  }
+
+  archive_read_close(archive);
+  archive_read_free(archive);
+
+  return success ? written : -1;
+
+}
+
+// Streams a single named file from the given archive to the destination path, returns true if successful
+bool ToolsExtract::extractArchiveMember (const std::filesystem::path path, const std::string &name, const std::filesystem::path dest) {
+  return ToolsExtract::extractArchiveMembers(path, [&name, &dest](const std::string &member, const std::string &magic) {
+    return member == name ? dest : std::filesystem::path();
+  }, 1) == 1;
+}
+
+// Holds the file a transcoded archive is written to, and the CRC64 of what has been written so far
+struct transcodeWriterState {
+  std::ofstream file;
+  uint64_t crc = 0;
+};
+
+// libarchive write callback, writes the next chunk of a transcoded archive to its file
+la_ssize_t transcodeWriterWrite (struct archive *archive, void *data, const void *buffer, size_t length) {
+
+  transcodeWriterState *state = static_cast<transcodeWriterState*>(data);
+
+  if (!state->file.write(static_cast<const char*>(buffer), length)) {
+    archive_set_error(archive, EIO, "Failed to write transcoded archive");
+    return -1;
+  }
+  state->crc = lzma_crc64(static_cast<const uint8_t*>(buffer), length, state->crc);
+  return length;
+
+}
+
+// Re-encodes a local archive as a zstd-compressed tar, which decodes several times faster than xz
+// Computes the CRC64 of the new archive along the way. Gives up and removes the output as soon as keepGoing returns false
+bool ToolsExtract::transcodeArchive (const std::filesystem::path path, const std::filesystem::path dest, std::function<bool ()> keepGoing, uint64_t &crc) {
+
+  // A libarchive built without zstd (or one that would hand it to an external program) can't do this at any later point either
+  struct archive* output = archive_write_new();
+  if (archive_write_add_filter_zstd(output) != ARCHIVE_OK) {
+    LOGFILE << "[W] This build of libarchive can't write zstd, transcoding is disabled for this session" << std::endl;
+    TRANSCODE_ENABLE = false;
+    archive_write_free(output);
+    return false;
+  }
+
+  localArchiveState archiveState;
+  struct archive* archive = openLocalArchive(path, archiveState);
+  if (!archive) {
+    archive_write_free(output);
+    return false;
+  }
+
+  archive_write_set_format_pax_restricted(output);
+  // Don't pad the end of the file to a full block, like archive_write_open_filename does for regular files
+  archive_write_set_bytes_in_last_block(output, 1);
+
+  transcodeWriterState writerState;
+  writerState.file.open(dest, std::ios::binary | std::ios::trunc);
+
+  if (!writerState.file.is_open() || archive_write_open(output, &writerState, nullptr, transcodeWriterWrite, nullptr) != ARCHIVE_OK) {
+    LOGFILE << "[E] Could not create file: " << archive_error_string(output) << std::endl;
+    archive_write_free(output);
+    archive_read_close(archive);
+    archive_read_free(archive);
+    return false;
+  }
+
+  std::vector<char> buffer(1 << 20);
+  bool success = true;
+
+  struct archive_entry* entry;
+  int result;
+  while (success && (result = archive_read_next_header(archive, &entry)) == ARCHIVE_OK) {
+
+    if (!keepGoing()) {
+      success = false;
+      break;
+    }
+
+    if (archive_write_header(output, entry) != ARCHIVE_OK) {
+      LOGFILE << "[E] Archive write error: " << archive_error_string(output) << std::endl;
+      success = false;
+      break;
+    }
+
+    la_ssize_t size;
+    while ((size = archive_read_data(archive, buffer.data(), buffer.size())) > 0) {
+      if (archive_write_data(output, buffer.data(), size) != size) {
+        LOGFILE << "[E] Archive write error: " << archive_error_string(output) << std::endl;
+        success = false;
+        break;
+      }
+    }
+    if (size < 0) {
+      LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
+      success = false;
+    }
+
+  }
+
+  if (success && result != ARCHIVE_EOF) {
+    LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
+    success = false;
+  }
+
+  if (archive_write_close(output) != ARCHIVE_OK) success = false;
+  archive_write_free(output);
+  archive_read_close(archive);
+  archive_read_free(archive);
+
+  writerState.file.close();
+  if (writerState.file.fail()) success = false;
+
+  if (!success) std::filesystem::remove(dest);
+  crc = writerState.crc;
+  return success;
+
+}
+
+// Returns true if this build can apply patches, see applyPatch
+bool ToolsExtract::canApplyPatches () {
+#ifndef TARGET_WINDOWS
+  return true;
+#else
+  // The Windows build doesn't ship with a zstd library of its own
+  return false;
+#endif
+}
+
+// Rebuilds a file from a zstd patch made with --patch-from against the given base file, writing it to dest
+// Computes the CRC64 of the rebuilt file along the way, so that it can be checked without reading it back
+bool ToolsExtract::applyPatch (const std::filesystem::path base, const std::filesystem::path patch, const std::filesystem::path dest, uint64_t &crc) {
+
+#ifndef TARGET_WINDOWS
+
+  // The patch refers back to anywhere in the base file, so all of it has to be at hand
+  mappedFile baseMapping;
+  if (!mapFile(baseMapping, base)) {
+    LOGFILE << "[E] Failed to map " << base << " into memory" << std::endl;
+    return false;
+  }
+  madvise(const_cast<uint8_t*>(baseMapping.data), baseMapping.size, MADV_RANDOM);
+
+  std::ifstream patchFile(patch, std::ios::binary);
+  std::ofstream output(dest, std::ios::binary | std::ios::trunc);
+  if (!patchFile.is_open() || !output.is_open()) {
+    LOGFILE << "[E] Failed to open " << patch << " or " << dest << std::endl;
+    return false;
+  }
+
+  // The window spans the whole base file, which is usually larger than the decoder accepts by default
+  ZSTD_DCtx *context = ZSTD_createDCtx();
+  ZSTD_DCtx_setParameter(context, ZSTD_d_windowLogMax, ZSTD_dParam_getBounds(ZSTD_d_windowLogMax).upperBound);
+  ZSTD_DCtx_refPrefix(context, baseMapping.data, baseMapping.size);
+
+  std::vector<char> inBuffer(ZSTD_DStreamInSize());
+  std::vector<char> outBuffer(ZSTD_DStreamOutSize());
+  size_t result = 1;
+  bool success = true;
+  crc = 0;
+
+  while (success && (patchFile.read(inBuffer.data(), inBuffer.size()) || patchFile.gcount() > 0)) {
+
+    ZSTD_inBuffer input = { inBuffer.data(), (size_t)patchFile.gcount(), 0 };
+
+    // The decoder doesn't consume the end of the frame until everything before it has been written out
+    while (input.pos < input.size) {
+      ZSTD_outBuffer decoded = { outBuffer.data(), outBuffer.size(), 0 };
+      result = ZSTD_decompressStream(context, &decoded, &input);
+      if (ZSTD_isError(result)) {
+        LOGFILE << "[E] Failed to apply patch " << patch << ": " << ZSTD_getErrorName(result) << std::endl;
+        success = false;
+        break;
+      }
+      output.write(outBuffer.data(), decoded.pos);
+      crc = lzma_crc64(reinterpret_cast<const uint8_t*>(outBuffer.data()), decoded.pos, crc);
+    }
+
+  }
+
+  ZSTD_freeDCtx(context);
+  output.close();
+
+  // Anything but a complete frame means the patch was cut short
+  if (success && result != 0) {
+    LOGFILE << "[E] Patch " << patch << " is truncated" << std::endl;
+    success = false;
+  }
+  if (success && !output) {
+    LOGFILE << "[E] Failed to write " << dest << std::endl;
+    success = false;
+  }
+
+  if (!success) std::filesystem::remove(dest);
+  return success;
+
+#else
+
+  // The Windows build doesn't ship with a zstd library of its own
+  LOGFILE << "[W] Patching isn't supported on this platform" << std::endl;
+  return false;
+
+#endif
+
+}
+
+// Holds the chunk most recently read from a stream for libarchive
+struct streamReaderState {
+  ToolsExtract::StreamReader reader;
+  std::vector<char> buffer = std::vector<char>(1 << 16);
+};
+
+// libarchive read callback, returns the next chunk of data from the stream
+la_ssize_t streamReaderRead (struct archive *archive, void *data, const void **buffer) {
+
+  streamReaderState *state = static_cast<streamReaderState*>(data);
+
+  *buffer = state->buffer.data();
+  const int64_t size = state->reader(state->buffer.data(), state->buffer.size());
+
+  if (size < 0) {
+    archive_set_error(archive, EIO, "Package download failed");
+    return ARCHIVE_FATAL;
+  }
+  return size;
+
+}
+
+// Extracts a tar.xz or tar.zst archive while it's still arriving, such as from a download
+// The stream isn't read past the end of the archive, what happens to the rest of it is up to the caller
+bool ToolsExtract::extractStream (ToolsExtract::StreamReader reader, const std::filesystem::path dest, const ToolsExtract::EntryFilter *filter) {
+
+  struct archive* archive;
+
+  archive = archive_read_new();
+  archive_read_support_format_tar(archive);
+  archive_read_support_filter_xz(archive);
+  archive_read_support_filter_zstd(archive);
+
+  streamReaderState streamState;
+  streamState.reader = reader;
+
+  if (archive_read_open(archive, &streamState, nullptr, streamReaderRead, nullptr) != ARCHIVE_OK) {
+    LOGFILE << "[E] Could not open stream: " << archive_error_string(archive) << std::endl;
+    archive_read_free(archive);
+    return false;
+  }
+
+  return extractOpenedArchive(archive, dest, filter);
+
+}
@@ -0,0 +1,40 @@
+#ifndef TOOLS_EXTRACT_H
+#define TOOLS_EXTRACT_H
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class ToolsExtract {
+  public:
+    // Supplies an archive as it arrives: fills the buffer and returns the number of bytes written to it,
+    // 0 once the stream has ended, or -1 if it has failed
+    typedef std::function<int64_t (char *data, size_t size)> StreamReader;
+
+    // Picks where an archive member gets written, given its name and first bytes. Empty path skips it
+    typedef std::function<std::filesystem::path (const std::string &name, const std::string &magic)> MemberSelector;
+
+    // Lets an extraction leave out files which exist elsewhere, checked by name and size first, then by CRC64 of the contents
+    struct EntryFilter {
+      std::function<bool (const std::string &name, uintmax_t size)> isCandidate;
+      std::function<bool (const std::string &name, uintmax_t size, uint64_t crc)> isRedundant;
+    };
+
+    static bool isPackageArchive (const std::string &magic);
+    static bool isPackageArchive (const std::filesystem::path path);
+    static uintmax_t getUncompressedSize (const std::filesystem::path path);
+    static bool extractLocalFile (const std::filesystem::path path, const std::filesystem::path dest, const EntryFilter *filter = nullptr);
+    static bool extractStream (StreamReader reader, const std::filesystem::path dest, const EntryFilter *filter = nullptr);
+    static bool verifyArchive (const std::filesystem::path path);
+    static std::vector<std::string> listArchiveEntries (const std::filesystem::path path);
+    static bool readArchiveMember (const std::filesystem::path path, const std::string &name, std::string &output);
+    static int extractArchiveMembers (const std::filesystem::path path, MemberSelector selector, int limit = -1);
+    static bool extractArchiveMember (const std::filesystem::path path, const std::string &name, const std::filesystem::path dest);
+    static bool transcodeArchive (const std::filesystem::path path, const std::filesystem::path dest, std::function<bool ()> keepGoing, uint64_t &crc);
+    static bool canApplyPatches ();
+    static bool applyPatch (const std::filesystem::path base, const std::filesystem::path patch, const std::filesystem::path dest, uint64_t &crc);
+};
+
+#endif
@@ -6,8 +6,15 @@
 #include <sstream>
 #include <dirent.h>
 #include <cstdlib>
+#include <cstdio>
 #include <thread>
 #include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
 
 #include <QString>
 #include <QRandomGenerator>
@@ -18,87 +25,30 @@
 #include "qt.h" // ToolsQT
 #include "js.h" // ToolsJS
 #include "merge.h" // ToolsMerge
+#include "extract.h" // ToolsExtract
+#include "basegame.h" // ToolsBaseGame
+#include "store.h" // ToolsStore
+#include "progress.h" // ToolsProgress
+#include "mirror.h" // ToolsMirror
 
 #ifdef TARGET_WINDOWS
-  #include "../deps/win32/include/archive.h"
-  #include "../deps/win32/include/archive_entry.h"
-
   #include <windows.h>
   #include <tlhelp32.h>
   #include <psapi.h>
   #include <locale>
   #include <codecvt>
 #else
-  #include <archive.h>
-  #include <archive_entry.h>
-
   #include <sys/stat.h>
+  #include <sys/resource.h>
+  #include <sys/ioctl.h>
+  #include <linux/fs.h>
+  #include <fcntl.h>
   #include <unistd.h>
 #endif
 
 // Definitions for this source file
 #include "install.h"
 
-// Extracts a tar.xz archive
-bool ToolsInstall::extractLocalFile (const std::filesystem::path path, const std::filesystem::path dest) {
-
-  struct archive* archive;
-  struct archive* extracted;
-  struct archive_entry* entry;
-
-  archive = archive_read_new();
-  archive_read_support_format_tar(archive);
-  archive_read_support_filter_xz(archive);
-  extracted = archive_write_disk_new();
-  archive_write_disk_set_options(extracted, ARCHIVE_EXTRACT_TIME);
-
-  if (archive_read_open_filename_w(archive, path.wstring().c_str(), 10240)) {
-    LOGFILE << "[E] Could not open file: " << archive_error_string(archive) << std::endl;
-    return false;
-  }
-
-  bool success = true;
-  while (archive_read_next_header(archive, &entry) == ARCHIVE_OK) {
-
-    std::filesystem::path full_path = dest / archive_entry_pathname(entry);
-    archive_entry_set_pathname_utf8(entry, full_path.string().c_str());
-
-    LOGFILE << "[I] Extracting: " << '"' << archive_entry_pathname(entry) << '"' << std::endl;
-    archive_write_header(extracted, entry);
-
-    const void* buff;
-    size_t size;
-    la_int64_t offset;
-    int err;
-
-    while (true) {
-      err = archive_read_data_block(archive, &buff, &size, &offset);
-      if (err == ARCHIVE_EOF) break;
-      if (err != ARCHIVE_OK) {
-        LOGFILE << "[E] Archive read error: " << archive_error_string(archive) << std::endl;
-        success = false;
-        break;
-      }
-      err = archive_write_data_block(extracted, buff, size, offset);
-      if (err != ARCHIVE_OK) {
-        LOGFILE << "[E] Archive write error: " << archive_error_string(extracted) << std::endl;
-        success = false;
-        break;
-      }
-    }
-    archive_write_finish_entry(extracted);
-
-  }
-
-  archive_read_close(archive);
-  archive_read_free(archive);
-  archive_write_close(extracted);
-  archive_write_free(extracted);
-
-  return success;
-
-}
-
 // Retrieves the path to a process executable using its name
 #ifndef TARGET_WINDOWS
 std::string ToolsInstall::getProcessPath (const std::string &processName) {
@@ -500,15 +450,166 @@ bool isDirectoryLink (const std::filesystem::path linkName) {
 }
 #endif
 
+// Creates a copy-on-write clone of a file where the filesystem supports it (btrfs, XFS)
+#ifndef TARGET_WINDOWS
+bool reflinkFile (const std::filesystem::path source, const std::filesystem::path dest) {
+
+  int sourceFd = open(source.c_str(), O_RDONLY);
+  if (sourceFd == -1) return false;
+
+  struct stat sourceStat;
+  if (fstat(sourceFd, &sourceStat) != 0) {
+    close(sourceFd);
+    return false;
+  }
+
+  int destFd = open(dest.c_str(), O_WRONLY | O_CREAT | O_EXCL, sourceStat.st_mode & 0777);
+  if (destFd == -1) {
+    close(sourceFd);
+    return false;
+  }
+
+  bool success = ioctl(destFd, FICLONE, sourceFd) == 0;
+  close(sourceFd);
+  close(destFd);
+
+  if (!success) unlink(dest.c_str());
+  return success;
+
+}
+#else
+bool reflinkFile (const std::filesystem::path source, const std::filesystem::path dest) {
+  return false;
+}
+#endif
+
+// Returns true for files which the game may rewrite in place, such as soundcaches and configs
+bool isGameWrittenFile (const std::filesystem::path path) {
+  const std::filesystem::path extension = path.extension();
+  return extension == ".cache" || extension == ".cfg";
+}
+
+// Clones a directory tree as cheaply as possible: reflinks, then hard links, then plain copies
+// Hard links share their contents with the cached tree, so the JS API replaces files instead of writing into them,
+// and files the game writes to get copied. Whichever method fails once isn't tried again for the rest of the tree
+bool cloneDirectory (const std::filesystem::path source, const std::filesystem::path dest) {
+
+  bool canReflink = true;
+  bool canLink = true;
+
+  try {
+    std::filesystem::create_directories(dest);
+
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(source)) {
+      const std::filesystem::path target = dest / entry.path().lexically_relative(source);
+
+      if (entry.is_symlink()) {
+        std::filesystem::copy_symlink(entry.path(), target);
+        continue;
+      }
+      if (entry.is_directory()) {
+        std::filesystem::create_directories(target);
+        continue;
+      }
+
+      if (canReflink) {
+        canReflink = reflinkFile(entry.path(), target);
+        if (canReflink) continue;
+      }
+      if (canLink && !isGameWrittenFile(target)) {
+        std::error_code error;
+        std::filesystem::create_hard_link(entry.path(), target, error);
+        if (!error) continue;
+        canLink = false;
+      }
+      std::filesystem::copy_file(entry.path(), target);
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    LOGFILE << "[E] Failed to clone " << source << " to " << dest << ": " << e.what() << std::endl;
+    return false;
+  }
+
+  return true;
+
+}
+
+// Returns the directory in which the pristine extracted tree of the given archive is kept
+std::filesystem::path getTreeCachePath (const std::filesystem::path archivePath) {
+  size_t archivePathHash = std::hash<std::string>{}(archivePath.string());
+  return CACHE_DIR / "extracted" / std::to_string(archivePathHash);
+}
+
+// Set whenever a cached tree gets removed, which may leave stored files that nothing links to anymore
+std::atomic<bool> storeNeedsPruning(true);
+
+// Empties a tree cache directory and invalidates its version file before extracting to it, returns false if that failed
+// This runs on worker and background threads, where a thrown filesystem error would take down the whole process
+bool clearTreeCache (const std::filesystem::path treePath) {
+
+  std::error_code error;
+  std::filesystem::remove(treePath.string() + ".ver", error);
+  if (!error) std::filesystem::remove(treePath.string() + ".skip", error);
+  if (!error) std::filesystem::remove(treePath.string() + ".sto", error);
+  storeNeedsPruning = true;
+
+  if (!error) std::filesystem::remove_all(treePath, error);
+  if (!error) std::filesystem::create_directories(treePath, error);
+  if (error) {
+    LOGFILE << "[E] Failed to clear cached tree " << treePath << ": " << error.message() << std::endl;
+    return false;
+  }
+  return true;
+
+}
+
+// Invalidates a cached tree and moves it out of the way, so that it can be deleted without holding anything up
+// Removing a whole tree takes a while, see removeRetiredTrees for where that happens
+bool retireTree (const std::filesystem::path treePath) {
+
+  std::error_code error;
+  std::filesystem::remove(treePath.string() + ".ver", error);
+  if (!error) std::filesystem::remove(treePath.string() + ".skip", error);
+  if (!error) std::filesystem::remove(treePath.string() + ".sto", error);
+  storeNeedsPruning = true;
+
+  if (!error && std::filesystem::exists(treePath, error)) {
+    const std::string suffix = ".old" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+    std::filesystem::rename(treePath, treePath.string() + suffix, error);
+  }
+  if (error) {
+    LOGFILE << "[E] Failed to retire cached tree " << treePath << ": " << error.message() << std::endl;
+    return false;
+  }
+  return true;
+
+}
+
+// Deletes the cached trees which have been moved out of the way by retireTree
+void removeRetiredTrees () {
+
+  std::vector<std::filesystem::path> retired;
+  std::error_code error;
+  for (const auto &entry : std::filesystem::directory_iterator(CACHE_DIR / "extracted", error)) {
+    if (entry.path().extension().string().rfind(".old", 0) == 0) retired.push_back(entry.path());
+  }
+
+  for (const std::filesystem::path &path : retired) {
+    std::filesystem::remove_all(path, error);
+    if (error) LOGFILE << "[W] Failed to remove retired tree " << path << ": " << error.message() << std::endl;
+  }
+
+}
+
 // Checks if the given file exists and is up-to-date
 bool ToolsInstall::validateFileVersion (std::filesystem::path filePath, const std::string &version) {
 
   // Check if the given file exists
-  if (!std::filesystem::exists(filePath)) return false;
+  std::error_code error;
+  if (!std::filesystem::exists(filePath, error)) return false;
 
   // Check if the respective version file exists
   filePath += ".ver";
-  if (!std::filesystem::exists(filePath)) return false;
+  if (!std::filesystem::exists(filePath, error)) return false;
 
   // Read the version file
   std::ifstream versionFile(filePath);
@@ -523,14 +624,17 @@ bool ToolsInstall::validateFileVersion (std::filesystem::path filePath, const st
 
 }
 
-// Write a version file for the given file
-bool ToolsInstall::updateFileVersion (std::filesystem::path filePath, const std::string &version) {
+// Write a version file for the given file, optionally recording its checksum on the second line
+// If the file has been re-encoded since it was published, the checksum it was published with goes on the third
+bool ToolsInstall::updateFileVersion (std::filesystem::path filePath, const std::string &version, const std::string &checksum, const std::string &publishedChecksum) {
 
   filePath += ".ver";
   std::ofstream versionFile(filePath);
 
   if (versionFile.is_open()) {
     versionFile << version;
+    if (!checksum.empty()) versionFile << '\n' << checksum;
+    if (!checksum.empty() && !publishedChecksum.empty()) versionFile << '\n' << publishedChecksum;
     versionFile.close();
     return true;
   }
@@ -538,6 +642,71 @@ bool ToolsInstall::updateFileVersion (std::filesystem::path filePath, const std:
 
 }
 
+// Points to the directory holding the files of the current package (set during installation)
+std::filesystem::path packageDirectoryPath;
+
+// Returns the directory holding the files of the installed or installing package
+std::filesystem::path ToolsInstall::getPackageDirectory () {
+  if (packageDirectoryPath.empty()) return CACHE_DIR / "tempcontent";
+  return packageDirectoryPath;
+}
+
+// Returns the package directory within the memory-backed staging area, or an empty path if it's disabled
+std::filesystem::path getStagingPackageDirectory () {
+  if (STAGING_DIR.empty()) return std::filesystem::path();
+  return STAGING_DIR / "spplice-tempcontent";
+}
+
+// Removes package files from both the disk and the memory-backed package directory
+void clearPackageDirectory () {
+  std::error_code error;
+  std::filesystem::remove_all(CACHE_DIR / "tempcontent", error);
+  const std::filesystem::path stagingPath = getStagingPackageDirectory();
+  if (!stagingPath.empty()) std::filesystem::remove_all(stagingPath, error);
+}
+
+// Returns the total size of all regular files in a directory tree
+uintmax_t getDirectorySize (const std::filesystem::path path) {
+  uintmax_t size = 0;
+  std::error_code error;
+  for (const auto &entry : std::filesystem::recursive_directory_iterator(path, error)) {
+    if (!entry.is_symlink() && entry.is_regular_file()) size += entry.file_size(error);
+  }
+  return size;
+}
+
+// Clears and creates the directory that package files get installed from, and returns its path
+// Packages are staged in memory when that's enabled and they fit, or on disk otherwise
+std::filesystem::path preparePackageDirectory (uintmax_t packageSize) {
+
+  clearPackageDirectory();
+  packageDirectoryPath = CACHE_DIR / "tempcontent";
+
+  const std::filesystem::path stagingPath = getStagingPackageDirectory();
+  if (!stagingPath.empty()) {
+
+    // Leave headroom for files written by the JS API and the game
+    std::error_code error;
+    const std::filesystem::space_info space = std::filesystem::space(STAGING_DIR, error);
+    const uintmax_t requiredSpace = packageSize + packageSize / 10 + (256 << 20);
+
+    if (packageSize == 0) {
+      LOGFILE << "[I] Package size is unknown, staging it on disk" << std::endl;
+    } else if (error || space.available < requiredSpace) {
+      LOGFILE << "[W] Package (" << ToolsStore::formatSize(packageSize) << ") doesn't fit in " << STAGING_DIR
+        << " (" << ToolsStore::formatSize(error ? 0 : space.available) << " available), staging it on disk" << std::endl;
+    } else {
+      LOGFILE << "[I] Staging package (" << ToolsStore::formatSize(packageSize) << ") in memory at " << stagingPath << std::endl;
+      packageDirectoryPath = stagingPath;
+    }
+
+  }
+
+  std::filesystem::create_directories(packageDirectoryPath);
+  return packageDirectoryPath;
+
+}
+
 // Installs the given directory of package files
 std::string installPackageDirectory (const std::filesystem::path packageDirectory, const std::vector<std::string> args) {
 
@@ -585,6 +754,10 @@ std::string installPackageDirectory (const std::filesystem::path packageDirector
   GAME_DIR = std::filesystem::path(gameProcessPath).parent_path();
   LOGFILE << "[I] Found " << SPPLICE_STEAMAPP_NAMES[SPPLICE_STEAMAPP_INDEX] << " at " << GAME_DIR << std::endl;
 
+  // Index the base game files in the background if that hasn't been done for this game yet this session,
+  // so that the next extraction can skip files already in the game
+  ToolsBaseGame::startIndex(GAME_DIR, SPPLICE_STEAMAPP_DIRS[SPPLICE_STEAMAPP_INDEX]);
+
   std::filesystem::path tempcontentPath = GAME_DIR / (SPPLICE_STEAMAPP_DIRS[SPPLICE_STEAMAPP_INDEX] + "_tempcontent");
 
   // Handle an existing tempcontent directory
@@ -646,21 +819,451 @@ std::string installPackageDirectory (const std::filesystem::path packageDirector
 }
 
 // Extracts and installs the given package file
-std::string ToolsInstall::installPackageFile (const std::filesystem::path packageFile, const std::vector<std::string> args) {
+// Files identical to those of the base game are left out, unless skipBaseFiles is false
+std::string ToolsInstall::installPackageFile (const std::filesystem::path packageFile, const std::vector<std::string> args, const std::string &version, bool skipBaseFiles) {
+
+  ToolsExtract::EntryFilter filter;
+  std::vector<std::string> skippedFiles;
+  const bool useFilter = skipBaseFiles && ToolsBaseGame::createFilter(filter, skippedFiles);
+
+  // Without a version to validate against, skip the extracted tree cache
+  if (!CACHE_ENABLE || version.empty()) {
+    // Extract the package to a temporary directory
+    const std::filesystem::path packageDirectory = preparePackageDirectory(ToolsExtract::getUncompressedSize(packageFile));
+    if (!ToolsExtract::extractLocalFile(packageFile, packageDirectory, useFilter ? &filter : nullptr)) {
+      return "Failed to extract package. Please clear the cache and try again.";
+    }
+    ToolsBaseGame::saveIndex();
+    return installPackageDirectory(packageDirectory, args);
+  }
 
-  // Extract the package to a temporary directory
-  const std::filesystem::path packageDirectory = CACHE_DIR / "tempcontent";
-  if (std::filesystem::exists(packageDirectory)) {
-    std::filesystem::remove_all(packageDirectory);
+  // Extract to the tree cache, unless this version has been extracted before
+  // A cached tree with files left out is only valid while those files are still the same in the base game
+  const std::filesystem::path treePath = getTreeCachePath(packageFile);
+  const bool treeValid = ToolsInstall::validateFileVersion(treePath, version) && (skipBaseFiles
+    ? ToolsBaseGame::validateSkippedFiles(treePath)
+    : !std::filesystem::exists(treePath.string() + ".skip"));
+
+  if (treeValid) {
+    LOGFILE << "[I] Extracted package found in cache, skipping extraction" << std::endl;
+  } else {
+    if (!clearTreeCache(treePath)) {
+      return "Failed to prepare package files. Please clear the cache and try again.";
+    }
+    if (!ToolsExtract::extractLocalFile(packageFile, treePath, useFilter ? &filter : nullptr)) {
+      std::error_code error;
+      std::filesystem::remove_all(treePath, error);
+      return "Failed to extract package. Please clear the cache and try again.";
+    }
+    ToolsBaseGame::saveSkippedFiles(treePath, skippedFiles);
+    ToolsBaseGame::saveIndex();
+    ToolsInstall::updateFileVersion(treePath, version);
+  }
+
+  // The game and JS scripts work on a clone, keeping the cached tree pristine
+  const std::filesystem::path packageDirectory = preparePackageDirectory(getDirectorySize(treePath));
+  if (!cloneDirectory(treePath, packageDirectory)) {
+    return "Failed to prepare package files. Please clear the cache and try again.";
+  }
+
+  // Install the files from the cloned directory
+  return installPackageDirectory(packageDirectory, args);
+
+}
+
+// Returns the path at which the given package's archive is cached
+std::filesystem::path ToolsInstall::getCachePath (const ToolsPackage::PackageData *package) {
+  // Generate a hash from the file's URL to use as a file name
+  size_t fileURLHash = std::hash<std::string>{}(package->file);
+  return CACHE_DIR / std::to_string(fileURLHash);
+}
+
+// Parses a CRC64 written in hex, as found in repository indices and version files. Returns false if it's missing or malformed
+bool parseChecksum (const std::string &text, uint64_t &crc) {
+  if (text.empty()) return false;
+  char *end = nullptr;
+  crc = std::strtoull(text.c_str(), &end, 16);
+  return *end == '\0';
+}
+
+// Formats a CRC64 for storing in a version file
+std::string formatChecksum (uint64_t crc) {
+  char text[17];
+  std::snprintf(text, sizeof(text), "%016llx", static_cast<unsigned long long>(crc));
+  return text;
+}
+
+// Reads the checksums recorded in the version file of the given file, see ToolsInstall::updateFileVersion
+// The published checksum is the same as that of the file, unless the file has been re-encoded. Missing ones are left empty
+void readFileChecksums (const std::filesystem::path filePath, std::string &checksum, std::string &publishedChecksum) {
+  std::ifstream versionFile(filePath.string() + ".ver");
+  std::string version;
+  std::getline(versionFile, version);
+  if (!std::getline(versionFile, checksum)) checksum = "";
+  if (!std::getline(versionFile, publishedChecksum)) publishedChecksum = checksum;
+}
+
+// Returns false if the given CRC64 of a downloaded archive contradicts the checksum published by the repository
+bool matchesPublishedChecksum (const ToolsPackage::PackageData *package, uint64_t crc) {
+
+  uint64_t expected;
+  if (!parseChecksum(package->crc64, expected) || crc == expected) return true;
+
+  LOGFILE << "[E] Downloaded archive of \"" << package->title << "\" is corrupt: checksum " << formatChecksum(crc)
+    << ", expected " << formatChecksum(expected) << std::endl;
+  return false;
+
+}
+
+// Marks the cached archive of the given package as complete and valid, recording its CRC64
+// Archives of packages which publish patches are kept in the format they were published in, as that's what the patches apply to
+// That's only worth it where patches can be applied, elsewhere they get transcoded like any other
+bool markCachedArchive (const ToolsPackage::PackageData *package, const std::filesystem::path cachePath, uint64_t checksum) {
+  if (!package->patches.empty() && ToolsExtract::canApplyPatches()) std::ofstream(cachePath.string() + ".fmt") << "original";
+  return ToolsInstall::updateFileVersion(cachePath, package->version, formatChecksum(checksum));
+}
+
+// Returns true if the given cached archive still holds the bytes it was published as, rather than a re-encoded copy
+bool isPublishedFormat (const std::filesystem::path cachePath) {
+  std::ifstream formatFile(cachePath.string() + ".fmt");
+  std::string format;
+  return !formatFile.is_open() || (std::getline(formatFile, format) && format == "original");
+}
+
+// Returns the path at which a new version of the given cached archive is kept until it replaces the old one
+std::filesystem::path getRefreshPath (const std::filesystem::path cachePath) {
+  return cachePath.string() + ".new";
+}
+
+// Deletes the new version of the given cached archive, along with its metadata
+void discardRefresh (const std::filesystem::path cachePath) {
+  const std::string refreshPath = getRefreshPath(cachePath).string();
+  std::error_code error;
+  std::filesystem::remove(refreshPath, error);
+  std::filesystem::remove(refreshPath + ".ver", error);
+  std::filesystem::remove(refreshPath + ".fmt", error);
+}
+
+// Replaces a cached archive with the new version waiting at its refresh path, which has been verified and marked already
+// This only renames files, so that it's quick enough to do under prefetchMutex, the old tree is left for removeRetiredTrees
+bool promoteRefresh (const std::filesystem::path cachePath) {
+
+  const std::string refreshPath = getRefreshPath(cachePath).string();
+  std::error_code error;
+
+  std::filesystem::remove(cachePath.string() + ".ver", error);
+  std::filesystem::remove(cachePath.string() + ".fmt", error);
+  std::filesystem::rename(refreshPath, cachePath, error);
+  if (error) {
+    LOGFILE << "[E] Failed to replace " << cachePath << " with its new version: " << error.message() << std::endl;
+    discardRefresh(cachePath);
+    return false;
+  }
+
+  // The version file goes last, as it's what marks the archive as valid
+  if (std::filesystem::exists(refreshPath + ".fmt", error)) std::filesystem::rename(refreshPath + ".fmt", cachePath.string() + ".fmt", error);
+  std::filesystem::rename(refreshPath + ".ver", cachePath.string() + ".ver", error);
+
+  // The files extracted from the old version are of no use anymore, a tree that's left over just fails validation later
+  retireTree(getTreeCachePath(cachePath));
+  return true;
+
+}
+
+// Puts the verified new version of a cached archive, written to its refresh path, in place of the old one
+// If a package is being installed, and `defer` is set, it's kept aside until Spplice is idle instead, see promoteRefreshes
+bool acceptRefresh (const ToolsPackage::PackageData *package, const std::filesystem::path cachePath, uint64_t checksum, bool defer) {
+
+  if (!markCachedArchive(package, getRefreshPath(cachePath), checksum)) {
+    LOGFILE << "[W] Couldn't open package version file for writing" << std::endl;
+    discardRefresh(cachePath);
+    return false;
+  }
+
+  if (defer && SPPLICE_INSTALL_STATE != 0) {
+    LOGFILE << "[I] Keeping version " << package->version << " of \"" << package->title << "\" aside until nothing is being installed" << std::endl;
+    return true;
+  }
+  return promoteRefresh(cachePath);
+
+}
+
+// Returns true if an up-to-date archive of the given package is in the cache
+// The checksum recorded when the archive was downloaded stands in for the archive itself, which isn't read again
+bool ToolsInstall::isPackageCached (const ToolsPackage::PackageData *package) {
+
+  const std::filesystem::path cachePath = ToolsInstall::getCachePath(package);
+  if (!CACHE_ENABLE || !ToolsInstall::validateFileVersion(cachePath, package->version)) return false;
+
+  // A republished archive under the same version is only caught by its checksum
+  std::string checksum, publishedChecksum;
+  readFileChecksums(cachePath, checksum, publishedChecksum);
+  uint64_t recorded, expected;
+  if (!parseChecksum(publishedChecksum, recorded) || !parseChecksum(package->crc64, expected)) return true;
+  return recorded == expected;
+
+}
+
+// Returns true if the given file starts with the xz magic bytes
+bool isXZFile (const std::filesystem::path path) {
+  const char magic[] = { '\xFD', '7', 'z', 'X', 'Z', '\0' };
+  char header[sizeof(magic)] = { 0 };
+  std::ifstream file(path, std::ios::binary);
+  file.read(header, sizeof(header));
+  return file.gcount() == sizeof(header) && std::equal(header, header + sizeof(header), magic);
+}
+
+// Re-encodes a single cached archive with zstd, keeping the original if anything changes in the meantime
+void transcodeCachedArchive (const std::filesystem::path archivePath) {
+
+  std::filesystem::path versionPath = archivePath;
+  versionPath += ".ver";
+  std::ifstream versionFile(versionPath);
+  std::string version;
+  if (!std::getline(versionFile, version)) return;
+  versionFile.close();
+
+  std::string checksum, publishedChecksum;
+  readFileChecksums(archivePath, checksum, publishedChecksum);
+
+  std::filesystem::path transcodePath = archivePath;
+  transcodePath += ".transcode";
+
+  const auto start = std::chrono::steady_clock::now();
+  uint64_t crc;
+  const bool success = ToolsExtract::transcodeArchive(archivePath, transcodePath, []() {
+    return SPPLICE_INSTALL_STATE == 0 && CACHE_ENABLE && TRANSCODE_ENABLE;
+  }, crc);
+  if (!success) return;
+
+  // Only swap the archives if the cached version is still the one that was transcoded, and it hasn't been marked to be kept since
+  std::error_code error;
+  if (!ToolsInstall::validateFileVersion(archivePath, version) || std::filesystem::exists(archivePath.string() + ".fmt")) {
+    std::filesystem::remove(transcodePath, error);
+    return;
+  }
+
+  const uintmax_t oldSize = std::filesystem::file_size(archivePath, error);
+  std::filesystem::rename(transcodePath, archivePath, error);
+  if (error) {
+    LOGFILE << "[W] Failed to replace " << archivePath << " with its transcoded copy: " << error.message() << std::endl;
+    std::filesystem::remove(transcodePath, error);
+    return;
+  }
+
+  // Record the new format next to the version, so that the archive isn't picked up again
+  std::filesystem::path formatPath = archivePath;
+  formatPath += ".fmt";
+  std::ofstream(formatPath) << "zstd";
+
+  // The checksum describes the archive as it is now, the one it was published with is kept for comparing against the repository
+  if (!checksum.empty()) ToolsInstall::updateFileVersion(archivePath, version, formatChecksum(crc), publishedChecksum);
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  LOGFILE << "[I] Transcoded " << archivePath << " to zstd in " << seconds << "s ("
+    << (oldSize >> 10) << " KiB -> " << (std::filesystem::file_size(archivePath, error) >> 10) << " KiB)" << std::endl;
+
+}
+
+// Re-encodes cached xz archives with zstd, for as long as Spplice stays idle
+// This makes later extractions from the cache (merges, tree cache misses) bound by I/O instead of xz decoding
+void transcodeCachedArchives () {
+
+  // Look for valid cached xz archives which haven't been transcoded yet
+  std::vector<std::filesystem::path> archives;
+  try {
+    for (const auto &entry : std::filesystem::directory_iterator(CACHE_DIR)) {
+      if (!entry.is_regular_file() || entry.path().has_extension()) continue;
+      std::filesystem::path formatPath = entry.path();
+      formatPath += ".fmt";
+      std::filesystem::path versionPath = entry.path();
+      versionPath += ".ver";
+      if (std::filesystem::exists(formatPath) || !std::filesystem::exists(versionPath)) continue;
+      if (isXZFile(entry.path())) archives.push_back(entry.path());
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    LOGFILE << "[W] Failed to scan the cache for archives to transcode: " << e.what() << std::endl;
+    return;
+  }
+
+  for (const std::filesystem::path &archivePath : archives) {
+    if (SPPLICE_INSTALL_STATE != 0 || !CACHE_ENABLE || !TRANSCODE_ENABLE) break;
+    transcodeCachedArchive(archivePath);
+  }
+
+}
+
+// Returns the size of the given file, or 0 if it doesn't exist
+uintmax_t getFileSizeOrZero (const std::filesystem::path path) {
+  std::error_code error;
+  const uintmax_t size = std::filesystem::file_size(path, error);
+  return error ? 0 : size;
+}
+
+// Brings the cached archive of the given package up to date with a patch against its cached version, if the repository has one
+// The patched archive only replaces the cached one once its checksum matches the repository's. Returns true if it did
+// In the background (given a cancel flag), the patch is fetched like a prefetch of at most `budget` bytes,
+// and the bytes received get added to `transferred`
+bool patchCachedArchive (const ToolsPackage::PackageData *package, const std::atomic<bool> *cancel = nullptr, uintmax_t budget = 0, uintmax_t *transferred = nullptr) {
+
+  if (!CACHE_ENABLE || package->repository == "local" || package->patches.empty()) return false;
+  if (!ToolsExtract::canApplyPatches()) return false;
+
+  // Patches apply to the archive as it was published, not to one that's since been re-encoded
+  const std::filesystem::path cachePath = ToolsInstall::getCachePath(package);
+  std::error_code error;
+  if (!std::filesystem::exists(cachePath, error) || !isPublishedFormat(cachePath)) return false;
+
+  std::ifstream versionFile(cachePath.string() + ".ver");
+  std::string cachedVersion;
+  if (!std::getline(versionFile, cachedVersion) || cachedVersion == package->version) return false;
+  versionFile.close();
+
+  const auto patch = std::find_if(package->patches.begin(), package->patches.end(), [&cachedVersion](const ToolsPackage::PatchData &patch) {
+    return patch.from == cachedVersion;
+  });
+  if (patch == package->patches.end()) return false;
+
+  uint64_t expectedCRC;
+  if (!parseChecksum(package->crc64, expectedCRC)) {
+    LOGFILE << "[W] Invalid checksum \"" << package->crc64 << "\" for \"" << package->title << "\", not patching it" << std::endl;
+    return false;
+  }
+
+  LOGFILE << "[I] Patching cached \"" << package->title << "\" from version " << cachedVersion << " to " << package->version << std::endl;
+
+  const std::filesystem::path patchPath = cachePath.string() + ".patch";
+  const std::filesystem::path patchedPath = getRefreshPath(cachePath);
+
+  bool downloaded;
+  if (cancel) {
+    downloaded = ToolsCURL::prefetchFile({ patch->file }, patchPath, budget, *cancel);
+    if (transferred) *transferred += getFileSizeOrZero(downloaded ? patchPath : std::filesystem::path(patchPath.string() + ".part"));
+  } else {
+    ToolsProgress::expect(ToolsProgress::STAGE_DOWNLOAD, 1, 0);
+    downloaded = ToolsCURL::downloadFile(patch->file, patchPath);
+    if (downloaded) ToolsProgress::add(ToolsProgress::STAGE_DOWNLOAD, 1, 0);
+  }
+  if (!downloaded) return false;
+
+  uint64_t crc = 0;
+  const uintmax_t patchSize = getFileSizeOrZero(patchPath);
+  const bool applied = ToolsExtract::applyPatch(cachePath, patchPath, patchedPath, crc);
+  std::filesystem::remove(patchPath, error);
+
+  if (applied && crc != expectedCRC) {
+    LOGFILE << "[W] Patched archive of \"" << package->title << "\" doesn't match the repository's checksum, discarding it" << std::endl;
+  }
+
+  if (!applied || crc != expectedCRC) {
+    discardRefresh(cachePath);
+    return false;
   }
-  std::filesystem::create_directories(packageDirectory);
 
-  if (!extractLocalFile(packageFile, packageDirectory)) {
+  // In the background, don't pull the archive out from under an install
+  if (!acceptRefresh(package, cachePath, crc, cancel != nullptr)) return false;
+
+  LOGFILE << "[I] Patched cached \"" << package->title << "\" to version " << package->version << " with a "
+    << (patchSize >> 10) << " KiB patch" << std::endl;
+  return true;
+
+}
+
+// Downloads, extracts and installs the given package, extracting the archive as it arrives
+std::string ToolsInstall::installPackageStream (const ToolsPackage::PackageData *package) {
+
+  // Clear the temporary package directory
+  clearPackageDirectory();
+  std::filesystem::path packageDirectory;
+
+  // Patching an outdated cached archive beats streaming the whole new one, this needs the old version file
+  if (patchCachedArchive(package)) {
+    return ToolsInstall::installPackageFile(ToolsInstall::getCachePath(package), package->args, package->version, package->skipBaseFiles);
+  }
+
+  // If caching is enabled, the download also gets written to the cache as it streams,
+  // and the archive gets extracted to the tree cache instead of straight to tempcontent
+  std::filesystem::path cachePath;
+  std::filesystem::path extractPath;
+  std::error_code error;
+  if (CACHE_ENABLE) {
+    cachePath = ToolsInstall::getCachePath(package);
+    // Invalidate any older version of the archive before overwriting it
+    std::filesystem::remove(cachePath.string() + ".ver", error);
+    std::filesystem::remove(cachePath.string() + ".fmt", error);
+    extractPath = getTreeCachePath(cachePath);
+    if (!clearTreeCache(extractPath)) {
+      return "Failed to prepare package files. Please clear the cache and try again.";
+    }
+  } else {
+    // The package size isn't known ahead of the download
+    packageDirectory = preparePackageDirectory(0);
+    extractPath = packageDirectory;
+  }
+
+  // Download on a separate thread, buffering at most 32 MiB ahead of the extractor
+  ToolsCURL::DownloadPipe pipe(32 << 20);
+  bool downloadSuccess = false;
+  uint64_t checksum = 0;
+  ToolsProgress::expect(ToolsProgress::STAGE_DOWNLOAD, 1, 0);
+  std::thread downloader([package, &pipe, &cachePath, &downloadSuccess, &checksum]() {
+    downloadSuccess = ToolsCURL::downloadToPipe(ToolsMirror::rankSources(package->file, package->mirrors), pipe, cachePath, &checksum);
+    if (downloadSuccess) ToolsProgress::add(ToolsProgress::STAGE_DOWNLOAD, 1, 0);
+  });
+
+  // Leave out files identical to those of the base game, unless the package opts out
+  ToolsExtract::EntryFilter filter;
+  std::vector<std::string> skippedFiles;
+  const bool useFilter = package->skipBaseFiles && ToolsBaseGame::createFilter(filter, skippedFiles);
+
+  LOGFILE << "[I] Streaming package from \"" << package->file << '"' << std::endl;
+  bool extractSuccess = ToolsExtract::extractStream([&pipe](char *data, size_t size) -> int64_t {
+    // An empty read means the download has ended, check whether it ended well
+    const size_t count = pipe.read(data, size);
+    return count == 0 && pipe.failed() ? -1 : count;
+  }, extractPath, useFilter ? &filter : nullptr);
+
+  // Let the download run to completion so that the cache file is whole,
+  // or stop it right away if the archive turned out to be broken, unblocking the downloader
+  if (extractSuccess) {
+    std::vector<char> buffer(1 << 16);
+    while (pipe.read(buffer.data(), buffer.size()) > 0);
+  } else {
+    pipe.abort();
+  }
+  downloader.join();
+  ToolsBaseGame::saveIndex();
+
+  // The archive has been extracted by now, but what came out of a corrupt one mustn't get installed
+  const bool checksumValid = !downloadSuccess || matchesPublishedChecksum(package, checksum);
+
+  if (!downloadSuccess || !extractSuccess || !checksumValid) {
+    if (!cachePath.empty()) {
+      // An interrupted download keeps its .part file to resume from, but a complete archive that fails to extract is useless
+      if (downloadSuccess) std::filesystem::remove(cachePath, error);
+      std::filesystem::remove_all(extractPath, error);
+    }
+    if (!downloadSuccess) return "Failed to download package file.";
+    if (!checksumValid) return "Downloaded package file is corrupt. Please try again.";
     return "Failed to extract package. Please clear the cache and try again.";
   }
 
+  if (CACHE_ENABLE) {
+    // Mark the cached archive and tree as valid only once they've been fully received, the archive may not have been written
+    if (std::filesystem::exists(cachePath, error) && !markCachedArchive(package, cachePath, checksum)) {
+      LOGFILE << "[W] Couldn't open package version file for writing" << std::endl;
+    }
+    ToolsBaseGame::saveSkippedFiles(extractPath, skippedFiles);
+    ToolsInstall::updateFileVersion(extractPath, package->version);
+    // The game and JS scripts work on a clone, keeping the cached tree pristine
+    packageDirectory = preparePackageDirectory(getDirectorySize(extractPath));
+    if (!cloneDirectory(extractPath, packageDirectory)) {
+      return "Failed to prepare package files. Please clear the cache and try again.";
+    }
+  }
+
   // Install the files from the extracted directory
-  return installPackageDirectory(packageDirectory, args);
+  return installPackageDirectory(packageDirectory, package->args);
 
 }
 
@@ -678,21 +1281,33 @@ std::filesystem::path ToolsInstall::downloadPackageFromData (const ToolsPackage:
     return (APP_DIR / "local") / package->file;
   }
 
-  // Generate a hash from the file's URL to use as a file name
-  size_t fileURLHash = std::hash<std::string>{}(package->file);
-  std::filesystem::path filePath = CACHE_DIR / std::to_string(fileURLHash);
+  std::filesystem::path filePath = ToolsInstall::getCachePath(package);
 
-  // Download the package file if we don't have a valid cache
-  if (CACHE_ENABLE && ToolsInstall::validateFileVersion(filePath, package->version)) {
+  // Download the package file if we don't have a valid cache, and can't patch the one we have
+  if (ToolsInstall::isPackageCached(package) || patchCachedArchive(package)) {
     LOGFILE << "[I] Cached package found, skipping download" << std::endl;
   } else {
-    if (CACHE_ENABLE && !ToolsInstall::updateFileVersion(filePath, package->version)) {
-      LOGFILE << "[W] Couldn't open package version file for writing" << std::endl;
-    }
-    if (!ToolsCURL::downloadFile(package->file, filePath)) {
+    // The freshly downloaded archive is in its original format again
+    // Merge sources get here on worker threads, where a thrown filesystem error would take down the whole process
+    std::error_code error;
+    std::filesystem::remove(filePath.string() + ".ver", error);
+    std::filesystem::remove(filePath.string() + ".fmt", error);
+    ToolsProgress::expect(ToolsProgress::STAGE_DOWNLOAD, 1, 0);
+    uint64_t checksum;
+    if (!ToolsCURL::downloadFileSegmented(ToolsMirror::rankSources(package->file, package->mirrors), filePath, ToolsCURL::PRIORITY_INSTALL, &checksum)) {
       // Return an empty path to indicate failure
       return std::filesystem::path();
     }
+    // The checksum was computed as the archive arrived, so a bad download is caught without reading it back
+    if (!matchesPublishedChecksum(package, checksum)) {
+      std::filesystem::remove(filePath, error);
+      return std::filesystem::path();
+    }
+    ToolsProgress::add(ToolsProgress::STAGE_DOWNLOAD, 1, 0);
+    // Mark the archive as valid only once it's complete, so that an interrupted download is never mistaken for it
+    if (CACHE_ENABLE && !markCachedArchive(package, filePath, checksum)) {
+      LOGFILE << "[W] Couldn't open package version file for writing" << std::endl;
+    }
   }
 
   // Return the downloaded archive
@@ -700,61 +1315,505 @@ std::filesystem::path ToolsInstall::downloadPackageFromData (const ToolsPackage:
 
 }
 
+// Maximum number of packages waiting to be prefetched, older intents are dropped first
+#define PREFETCH_QUEUE_SIZE 4
+
+// A package archive being fetched ahead of an expected install
+// Refreshes replace an outdated cached archive, which stays in place until the new one has been verified
+struct prefetchJob {
+  const ToolsPackage::PackageData *package;
+  std::filesystem::path cachePath;
+  std::filesystem::path outputPath;
+  bool refresh = false;
+  std::atomic<bool> cancel { false };
+};
+
+// Packages to prefetch, most recent intent first, cached packages to refresh once there are none,
+// and the job running right now
+std::mutex prefetchMutex;
+std::condition_variable prefetchUpdate;
+std::deque<const ToolsPackage::PackageData*> prefetchQueue;
+std::deque<const ToolsPackage::PackageData*> refreshQueue;
+prefetchJob *prefetchCurrent = nullptr;
+bool prefetchRunning = false;
+// Bytes fetched speculatively this session
+uintmax_t prefetchTransferred = 0;
+
+// Returns the bytes taken up by prefetched archives which haven't been installed yet, in this session or any before it
+// Each is marked by a ".pre" file next to it until an install claims it, markers of evicted archives are cleaned up
+uintmax_t getPrefetchedSize () {
+
+  uintmax_t size = 0;
+  std::error_code error;
+
+  for (const auto &entry : std::filesystem::directory_iterator(CACHE_DIR, error)) {
+    if (entry.path().extension() != ".pre") continue;
+
+    std::filesystem::path archivePath = entry.path();
+    archivePath.replace_extension();
+
+    const uintmax_t archiveSize = getFileSizeOrZero(archivePath) + getFileSizeOrZero(archivePath.string() + ".part");
+    if (archiveSize == 0) std::filesystem::remove(entry.path(), error);
+    size += archiveSize;
+  }
+
+  return size;
+
+}
+
+// Replaces a cached archive with its freshly downloaded new version, given its CRC64, once it has been verified
+void finishRefresh (const prefetchJob &job, uint64_t checksum) {
+
+  if (!matchesPublishedChecksum(job.package, checksum) || !ToolsExtract::verifyArchive(job.outputPath)) {
+    LOGFILE << "[W] Discarded the new version of \"" << job.package->title << '"' << std::endl;
+    discardRefresh(job.cachePath);
+    return;
+  }
+
+  // Don't pull the archive out from under an install, an install of this package claims it instead
+  if (acceptRefresh(job.package, job.cachePath, checksum, true)) {
+    LOGFILE << "[I] Updated cached \"" << job.package->title << "\" to version " << job.package->version << std::endl;
+  }
+
+}
+
+// Fetches queued packages one at a time until the queues run dry or the budget runs out
+void prefetchLoop () {
+
+  while (true) {
+
+    prefetchJob job;
+    uintmax_t budget;
+
+    // Whatever isn't installed yet counts against the disk budget, everything fetched counts against the bandwidth budget
+    // Refreshes only replace what's on disk already, so only the latter applies to them
+    // The cache gets scanned before taking the lock, which the UI thread takes to queue packages
+    const uintmax_t pending = getPrefetchedSize();
+    {
+      std::lock_guard<std::mutex> lock(prefetchMutex);
+
+      const uintmax_t diskLeft = PREFETCH_DISK_BUDGET > pending ? PREFETCH_DISK_BUDGET - pending : 0;
+      const uintmax_t bandwidthLeft = PREFETCH_BANDWIDTH_BUDGET > prefetchTransferred ? PREFETCH_BANDWIDTH_BUDGET - prefetchTransferred : 0;
+
+      job.refresh = prefetchQueue.empty();
+      budget = job.refresh ? bandwidthLeft : std::min(diskLeft, bandwidthLeft);
+
+      // Stop speculating once something is being installed, or the budget has run out
+      std::deque<const ToolsPackage::PackageData*> &queue = job.refresh ? refreshQueue : prefetchQueue;
+      if (queue.empty() || budget == 0 || SPPLICE_INSTALL_STATE != 0) {
+        if (!queue.empty() && budget == 0) LOGFILE << "[I] Prefetch budget used up, not prefetching any more packages" << std::endl;
+        prefetchQueue.clear();
+        refreshQueue.clear();
+        prefetchRunning = false;
+        return;
+      }
+
+      job.package = queue.front();
+      job.cachePath = ToolsInstall::getCachePath(job.package);
+      job.outputPath = job.refresh ? getRefreshPath(job.cachePath) : job.cachePath;
+      queue.pop_front();
+      prefetchCurrent = &job;
+    }
+
+    // Packages get queued without looking at the cache, as that happens on the UI thread
+    // A patch against the cached version is all either needs, if the repository has one
+    uintmax_t patchSize = 0;
+    const bool patched = patchCachedArchive(job.package, &job.cancel, budget, &patchSize);
+    if (patchSize > 0) {
+      std::lock_guard<std::mutex> lock(prefetchMutex);
+      prefetchTransferred += patchSize;
+    }
+
+    if (!patched && !ToolsInstall::isPackageCached(job.package)) {
+
+      // An uncaught filesystem error on this detached thread would take down the whole process
+      std::error_code error;
+      const std::filesystem::path partPath = job.outputPath.string() + ".part";
+      const uintmax_t before = getFileSizeOrZero(partPath);
+
+      if (job.refresh) {
+        LOGFILE << "[I] Downloading version " << job.package->version << " of cached \"" << job.package->title << '"' << std::endl;
+      } else {
+        LOGFILE << "[I] Prefetching \"" << job.package->title << "\" (up to " << (budget >> 20) << " MiB)" << std::endl;
+        // The old version of the archive, if any, is about to be replaced
+        std::filesystem::remove(job.cachePath.string() + ".ver", error);
+        std::filesystem::remove(job.cachePath.string() + ".fmt", error);
+      }
+
+      uint64_t checksum;
+      const bool success = ToolsCURL::prefetchFile(ToolsMirror::rankSources(job.package->file, job.package->mirrors), job.outputPath, budget, job.cancel, &checksum);
+      const uintmax_t after = getFileSizeOrZero(success ? job.outputPath : partPath);
+      bool discarded = false;
+
+      if (success && job.refresh) {
+        finishRefresh(job, checksum);
+      } else if (success && !matchesPublishedChecksum(job.package, checksum)) {
+        // A corrupt archive is of no use to the install, though its bytes still count as transferred
+        std::filesystem::remove(job.cachePath, error);
+        discarded = true;
+      } else if (success) {
+        markCachedArchive(job.package, job.cachePath, checksum);
+        LOGFILE << "[I] Prefetched \"" << job.package->title << "\" (" << (after >> 10) << " KiB)" << std::endl;
+      }
+
+      std::lock_guard<std::mutex> lock(prefetchMutex);
+      if (after > before) prefetchTransferred += after - before;
+      // A cancelled prefetch has been claimed by an install, so it's no longer speculative
+      if (after > 0 && !discarded && !job.cancel && !job.refresh) std::ofstream(job.cachePath.string() + ".pre");
+
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(prefetchMutex);
+      prefetchCurrent = nullptr;
+    }
+    prefetchUpdate.notify_all();
+
+  }
+
+}
+
+// Starts the prefetch thread if it isn't running already, expects prefetchMutex to be held
+void startPrefetchLoop () {
+  if (prefetchRunning) return;
+  prefetchRunning = true;
+  std::thread(prefetchLoop).detach();
+}
+
+// Starts fetching the given package's archive in the background, as the user seems about to install it
+// The archive goes into the cache, where a later install picks it up whether or not it's complete
+// This gets called from the UI thread, so it only queues the package, the prefetch thread checks whether it's cached already
+void ToolsInstall::prefetchPackage (const ToolsPackage::PackageData *package) {
+
+  // Only cached archives can be picked up later, and nothing should compete with an installed package for the network
+  if (!CACHE_ENABLE || PREFETCH_DISK_BUDGET == 0 || PREFETCH_BANDWIDTH_BUDGET == 0) return;
+  if (package->repository == "local" || SPPLICE_INSTALL_STATE != 0) return;
+
+  const std::filesystem::path cachePath = ToolsInstall::getCachePath(package);
+  std::lock_guard<std::mutex> lock(prefetchMutex);
+
+  // Skip packages which are already on their way
+  if (prefetchCurrent && prefetchCurrent->cachePath == cachePath) return;
+  for (const ToolsPackage::PackageData *queued : prefetchQueue) {
+    if (queued->file == package->file) return;
+  }
+
+  prefetchQueue.push_front(package);
+  if (prefetchQueue.size() > PREFETCH_QUEUE_SIZE) prefetchQueue.pop_back();
+
+  startPrefetchLoop();
+
+}
+
+// Queues a download of the new version of every package in the given list whose archive is cached in an older version
+// These run in the background once nothing else is being fetched, and replace the old archive only once verified
+void ToolsInstall::refreshCachedPackages (const std::vector<const ToolsPackage::PackageData*> &repository) {
+
+  if (!CACHE_ENABLE) return;
+
+  // Look at the cache before taking the lock, which the UI thread takes to queue packages
+  std::vector<const ToolsPackage::PackageData*> outdated;
+  for (const ToolsPackage::PackageData *package : repository) {
+
+    if (package->repository == "local") continue;
+
+    // Only archives which have been downloaded before, in a version (or with a checksum) that's since been replaced
+    const std::filesystem::path cachePath = ToolsInstall::getCachePath(package);
+    std::error_code error;
+    if (!std::filesystem::exists(cachePath, error) || !std::filesystem::exists(cachePath.string() + ".ver", error)) continue;
+
+    // Patches are listed by the new version, so keep the old archive from being transcoded until one is applied
+    if (!package->patches.empty() && ToolsExtract::canApplyPatches() && !std::filesystem::exists(cachePath.string() + ".fmt", error)) {
+      std::ofstream(cachePath.string() + ".fmt") << "original";
+    }
+
+    if (PREFETCH_BANDWIDTH_BUDGET == 0 || ToolsInstall::isPackageCached(package)) continue;
+    // The new version may be waiting to replace the old one already
+    if (ToolsInstall::validateFileVersion(getRefreshPath(cachePath), package->version)) continue;
+    outdated.push_back(package);
+
+  }
+
+  std::lock_guard<std::mutex> lock(prefetchMutex);
+  bool queued = false;
+
+  for (const ToolsPackage::PackageData *package : outdated) {
+
+    if (prefetchCurrent && prefetchCurrent->cachePath == ToolsInstall::getCachePath(package)) continue;
+    if (std::any_of(refreshQueue.begin(), refreshQueue.end(), [package](const ToolsPackage::PackageData *other) {
+      return other->file == package->file;
+    })) continue;
+
+    LOGFILE << "[I] Cached \"" << package->title << "\" is outdated, queued version " << package->version << std::endl;
+    refreshQueue.push_back(package);
+    queued = true;
+
+  }
+
+  if (queued) startPrefetchLoop();
+
+}
+
+// Takes over the prefetch or refresh of the given package (if any) for an install,
+// stopping it and waiting until it lets go of the archive
+void ToolsInstall::claimPrefetch (const ToolsPackage::PackageData *package) {
+
+  const std::filesystem::path cachePath = ToolsInstall::getCachePath(package);
+  std::unique_lock<std::mutex> lock(prefetchMutex);
+
+  auto samePackage = [package](const ToolsPackage::PackageData *queued) {
+    return queued->file == package->file;
+  };
+  prefetchQueue.erase(std::remove_if(prefetchQueue.begin(), prefetchQueue.end(), samePackage), prefetchQueue.end());
+  refreshQueue.erase(std::remove_if(refreshQueue.begin(), refreshQueue.end(), samePackage), refreshQueue.end());
+  std::error_code error;
+  std::filesystem::remove(cachePath.string() + ".pre", error);
+
+  if (prefetchCurrent && prefetchCurrent->cachePath == cachePath) {
+    LOGFILE << "[I] Taking over the prefetch of \"" << package->title << '"' << std::endl;
+    ToolsCURL::cancelTransfers(prefetchCurrent->cancel);
+    prefetchUpdate.wait(lock, [&cachePath]() {
+      return !prefetchCurrent || prefetchCurrent->cachePath != cachePath;
+    });
+  }
+
+  // A new version kept aside during another install is just what this one needs, an older one is of no use anymore
+  const std::filesystem::path refreshPath = getRefreshPath(cachePath);
+  if (ToolsInstall::validateFileVersion(refreshPath, package->version)) {
+    if (promoteRefresh(cachePath)) LOGFILE << "[I] Updated cached \"" << package->title << "\" to version " << package->version << std::endl;
+  } else {
+    discardRefresh(cachePath);
+  }
+
+  // The install downloads straight to the cache, so continue from the part a refresh has received
+  if (std::filesystem::exists(refreshPath.string() + ".part", error) && !std::filesystem::exists(cachePath.string() + ".part", error)) {
+    std::filesystem::rename(refreshPath.string() + ".part", cachePath.string() + ".part", error);
+    if (!error) std::filesystem::rename(refreshPath.string() + ".progress", cachePath.string() + ".progress", error);
+  }
+  ToolsCURL::discardPartial(refreshPath);
+
+}
+
+// Puts the new versions of cached archives which were kept aside during an install in place of the old ones
+void promoteRefreshes () {
+
+  std::vector<std::filesystem::path> cachePaths;
+  try {
+    for (const auto &entry : std::filesystem::directory_iterator(CACHE_DIR)) {
+      if (entry.path().extension() != ".new" || !std::filesystem::exists(entry.path().string() + ".ver")) continue;
+      cachePaths.push_back(entry.path().parent_path() / entry.path().stem());
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    LOGFILE << "[W] Failed to scan the cache for new archive versions: " << e.what() << std::endl;
+    return;
+  }
+
+  // Holding the lock keeps installs of these packages waiting in claimPrefetch, so only the renames happen under it
+  {
+    std::lock_guard<std::mutex> lock(prefetchMutex);
+    for (const std::filesystem::path &cachePath : cachePaths) {
+      if (SPPLICE_INSTALL_STATE != 0) break;
+      if (prefetchCurrent && prefetchCurrent->cachePath == cachePath) continue;
+      if (promoteRefresh(cachePath)) LOGFILE << "[I] Updated cached archive " << cachePath << std::endl;
+    }
+  }
+
+  // The trees of the old versions (and any retired during installs) get deleted once nothing waits on the lock
+  removeRetiredTrees();
+
+}
+
+// Retires cached trees whose archive is gone, or has been replaced by another version since they were extracted
+// Nothing else removes a tree, so each would otherwise take up space next to its archive for as long as the cache exists
+void evictStaleTrees () {
+
+  // Trees which still match an archive in the cache, local packages have no version file and match as long as they exist
+  std::unordered_set<std::string> current;
+  std::error_code error;
+
+  for (const auto &entry : std::filesystem::directory_iterator(CACHE_DIR, error)) {
+    if (entry.path().has_extension() || !entry.is_regular_file(error)) continue;
+    std::ifstream versionFile(entry.path().string() + ".ver");
+    std::string version;
+    const std::filesystem::path treePath = getTreeCachePath(entry.path());
+    if (std::getline(versionFile, version) && ToolsInstall::validateFileVersion(treePath, version)) {
+      current.insert(treePath.filename().string());
+    }
+  }
+  for (const auto &entry : std::filesystem::directory_iterator(APP_DIR / "local", error)) {
+    current.insert(getTreeCachePath(entry.path()).filename().string());
+  }
+
+  std::vector<std::filesystem::path> stale;
+  for (const auto &entry : std::filesystem::directory_iterator(CACHE_DIR / "extracted", error)) {
+    if (entry.path().has_extension() || !entry.is_directory(error)) continue;
+    if (current.count(entry.path().filename().string()) == 0) stale.push_back(entry.path());
+  }
+
+  for (const std::filesystem::path &treePath : stale) {
+    if (SPPLICE_INSTALL_STATE != 0 || !CACHE_ENABLE) return;
+    if (retireTree(treePath)) LOGFILE << "[I] Evicted stale cached tree " << treePath << std::endl;
+  }
+  removeRetiredTrees();
+
+}
+
+// Shares identical files of newly extracted trees through the store, then drops whatever removed trees left behind
+// Hashing a whole tree takes a while, so this is left for when Spplice is idle rather than done before the game starts
+void storeCachedTrees () {
+
+  // Complete trees which haven't been stored yet
+  std::vector<std::filesystem::path> trees;
+  try {
+    const std::filesystem::path extractedPath = CACHE_DIR / "extracted";
+    if (!std::filesystem::exists(extractedPath)) return;
+    for (const auto &entry : std::filesystem::directory_iterator(extractedPath)) {
+      if (!entry.is_directory() || !std::filesystem::exists(entry.path().string() + ".ver")) continue;
+      if (!std::filesystem::exists(entry.path().string() + ".sto")) trees.push_back(entry.path());
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    LOGFILE << "[W] Failed to scan the cache for trees to store: " << e.what() << std::endl;
+    return;
+  }
+
+  auto keepGoing = []() {
+    return SPPLICE_INSTALL_STATE == 0 && CACHE_ENABLE;
+  };
+
+  for (const std::filesystem::path &tree : trees) {
+    if (ToolsStore::storeTree(tree, keepGoing)) std::ofstream(tree.string() + ".sto");
+    else if (!keepGoing()) return;
+  }
+
+  if (keepGoing() && storeNeedsPruning.exchange(false)) ToolsStore::pruneStore();
+
+}
+
+// Runs forever on a background thread, keeping the cache in shape while Spplice is idle
+void ToolsInstall::maintainCache () {
+
+  // Stay out of the way of the UI, installs and the game
+#ifndef TARGET_WINDOWS
+  setpriority(PRIO_PROCESS, 0, 19); // On Linux, this applies only to the calling thread
+#else
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_IDLE);
+#endif
+
+  while (true) {
+
+    std::this_thread::sleep_for(std::chrono::seconds(60));
+    if (SPPLICE_INSTALL_STATE != 0 || !CACHE_ENABLE) continue;
+
+    promoteRefreshes();
+    evictStaleTrees();
+    storeCachedTrees();
+    if (TRANSCODE_ENABLE) transcodeCachedArchives();
+
+  }
+
+}
+
 // Merges a list of packages into one and installs it
+// Sources are downloaded and extracted concurrently, each extraction starting as soon as its download is done
 std::string ToolsInstall::installMergedPackage (std::vector<const ToolsPackage::PackageData*> sources) {
 
-  // Each package will be assigned a unique sequential index
-  int index = 0;
-  QStringList sourcePaths;
+  const auto start = std::chrono::steady_clock::now();
 
-  // Store all command line arguments in one list
-  std::vector<std::string> args;
+  // Holds what went wrong with each package, empty if it was prepared successfully
+  std::vector<std::string> errors(sources.size());
 
-  // Iterate through all selected packages
-  for (auto package : sources) {
-    index ++;
+  // Downloads (or finds) and extracts a single package to its own temporary directory
+  auto prepareSource = [&sources, &errors](size_t i) {
 
-    // Create an output directory for the package contents
-    const std::filesystem::path tmpPackageDirectory = CACHE_DIR / ("sppmerge" + std::to_string(index));
+    const ToolsPackage::PackageData *package = sources[i];
+
+    // Create an output directory for the package contents, each package gets a unique sequential index
+    const std::filesystem::path tmpPackageDirectory = CACHE_DIR / ("sppmerge" + std::to_string(i + 1));
     // Ensure a completely clean output directory
-    if (std::filesystem::exists(tmpPackageDirectory)) {
-      std::filesystem::remove_all(tmpPackageDirectory);
+    // This runs on a worker thread, where a thrown filesystem error would take down the whole process
+    std::error_code error;
+    if (std::filesystem::exists(tmpPackageDirectory, error)) {
+      std::filesystem::remove_all(tmpPackageDirectory, error);
+    }
+    if (!error) std::filesystem::create_directories(tmpPackageDirectory, error);
+    if (error) {
+      LOGFILE << "[E] Failed to prepare " << tmpPackageDirectory << ": " << error.message() << std::endl;
+      errors[i] = "Temporary directory could not be created.";
+      return;
     }
-    std::filesystem::create_directories(tmpPackageDirectory);
 
     // Download (or find) the package archive file
     std::filesystem::path archivePath = ToolsInstall::downloadPackageFromData(package);
-    if (archivePath.empty()) return "Some package files could not be obtained.";
+    if (archivePath.empty()) {
+      LOGFILE << "[E] Failed to obtain merge source \"" << package->title << '"' << std::endl;
+      errors[i] = "Package file could not be obtained.";
+      return;
+    }
 
     // Extract the archive file to its dedicated temporary directory
-    bool extractSuccess = extractLocalFile(archivePath, tmpPackageDirectory);
+    bool extractSuccess = ToolsExtract::extractLocalFile(archivePath, tmpPackageDirectory);
 
     // Remove downloaded archives if cache is disabled
     if (!CACHE_ENABLE && package->repository != "local") {
-      std::filesystem::remove(archivePath);
+      std::filesystem::remove(archivePath, error);
     }
 
     // Handle extraction failure
-    if (!extractSuccess) return "Some package files could not be extracted.";
+    if (!extractSuccess) {
+      LOGFILE << "[E] Failed to extract merge source \"" << package->title << '"' << std::endl;
+      errors[i] = "Package file could not be extracted.";
+    }
+
+  };
+
+  // Work through the sources on up to MERGE_CONCURRENCY threads, including this one
+  // Their downloads all share the CURL transfer thread, so they run in parallel over the same connections
+  // Each continues from whatever a prefetch has received so far, like a single install does
+  for (const ToolsPackage::PackageData *package : sources) ToolsInstall::claimPrefetch(package);
+  std::atomic<size_t> nextSource(0);
+  auto prepareLoop = [&sources, &nextSource, &prepareSource]() {
+    for (size_t i = nextSource ++; i < sources.size(); i = nextSource ++) prepareSource(i);
+  };
+
+  const size_t threadCount = std::max<size_t>(1, std::min<size_t>(MERGE_CONCURRENCY, sources.size()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < threadCount; i ++) threads.emplace_back(prepareLoop);
+  prepareLoop();
+  for (std::thread &thread : threads) thread.join();
+
+  // Report every package that failed, not just the first one
+  std::string errorMessage;
+  for (size_t i = 0; i < sources.size(); i ++) {
+    if (!errors[i].empty()) errorMessage += "\n" + sources[i]->title + ": " + errors[i];
+  }
+  if (!errorMessage.empty()) return "Some packages could not be prepared for merging:" + errorMessage;
 
-    // Store output package directories in a list for use with the merge tool
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  LOGFILE << "[I] Prepared " << sources.size() << " merge sources in " << seconds << "s on " << threadCount << " threads" << std::endl;
+
+  // Store output package directories in a list for use with the merge tool, keeping the selection order
+  QStringList sourcePaths;
+  for (size_t i = 1; i <= sources.size(); i ++) {
+    const std::filesystem::path tmpPackageDirectory = CACHE_DIR / ("sppmerge" + std::to_string(i));
 #ifndef TARGET_WINDOWS
     sourcePaths.push_back(QString::fromStdString(tmpPackageDirectory.string()));
 #else
     sourcePaths.push_back(QString::fromStdWString(tmpPackageDirectory.wstring()));
 #endif
+  }
 
-    // Add command line arguments to merged list
+  // Store all command line arguments in one list
+  std::vector<std::string> args;
+  for (auto package : sources) {
     args.insert(args.end(), package->args.begin(), package->args.end());
-
   }
 
-  // Ensure a clean output directory for the merged package
-  const std::filesystem::path packageDirectory = CACHE_DIR / "tempcontent";
-  if (std::filesystem::exists(packageDirectory)) {
-    std::filesystem::remove_all(packageDirectory);
+  // Ensure a clean output directory for the merged package, large enough to hold all sources
+  uintmax_t mergedSize = 0;
+  for (size_t i = 1; i <= sources.size(); i ++) {
+    mergedSize += getDirectorySize(CACHE_DIR / ("sppmerge" + std::to_string(i)));
   }
-  std::filesystem::create_directories(packageDirectory);
+  const std::filesystem::path packageDirectory = preparePackageDirectory(mergedSize);
 
 #ifndef TARGET_WINDOWS
   QString packageDirectoryQString = QString::fromStdString(packageDirectory.string());
@@ -802,8 +1861,8 @@ void ToolsInstall::uninstall () {
   const std::filesystem::path tempcontentPath = GAME_DIR / (SPPLICE_STEAMAPP_DIRS[SPPLICE_STEAMAPP_INDEX] + "_tempcontent");
   if (isDirectoryLink(tempcontentPath)) unlinkDirectory(tempcontentPath);
 
-  // Remove the actual package directory containing all package files
-  const std::filesystem::path tmpPackageDirectory = CACHE_DIR / "tempcontent";
-  std::filesystem::remove_all(tmpPackageDirectory);
+  // Remove the actual package directory containing all package files, wherever it was staged
+  clearPackageDirectory();
+  packageDirectoryPath.clear();
 
 }
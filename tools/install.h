@@ -8,10 +8,17 @@
 
 class ToolsInstall {
   public:
-    static bool extractLocalFile (const std::filesystem::path path, const std::filesystem::path dest);
     static bool validateFileVersion (std::filesystem::path filePath, const std::string &version);
-    static bool updateFileVersion (std::filesystem::path filePath, const std::string &version);
-    static std::string installPackageFile (const std::filesystem::path packageFile, const std::vector<std::string> args);
+    static bool updateFileVersion (std::filesystem::path filePath, const std::string &version, const std::string &checksum = "", const std::string &publishedChecksum = "");
+    static std::string installPackageFile (const std::filesystem::path packageFile, const std::vector<std::string> args, const std::string &version = "", bool skipBaseFiles = true);
+    static std::string installPackageStream (const ToolsPackage::PackageData *package);
+    static std::filesystem::path getPackageDirectory ();
+    static std::filesystem::path getCachePath (const ToolsPackage::PackageData *package);
+    static bool isPackageCached (const ToolsPackage::PackageData *package);
+    static void maintainCache ();
+    static void prefetchPackage (const ToolsPackage::PackageData *package);
+    static void refreshCachedPackages (const std::vector<const ToolsPackage::PackageData*> &repository);
+    static void claimPrefetch (const ToolsPackage::PackageData *package);
     static std::filesystem::path downloadPackageFromData (const ToolsPackage::PackageData *package);
     static std::string installMergedPackage (std::vector<const ToolsPackage::PackageData*> sources);
     static bool isGameRunning ();
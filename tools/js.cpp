@@ -70,7 +70,7 @@ struct customJS {
       if (!path) return duk_type_error(ctx, "fs.mkdir: Invalid path argument");
 
       // Normalize base path and input path
-      const std::filesystem::path basePath = std::filesystem::absolute(CACHE_DIR / "tempcontent");
+      const std::filesystem::path basePath = std::filesystem::absolute(ToolsInstall::getPackageDirectory());
       const std::filesystem::path fullPath = std::filesystem::absolute(basePath / path);
       // Check for path traversal
       if (fullPath.string().find(basePath.string()) != 0) {
@@ -89,7 +89,7 @@ struct customJS {
       if (!path) return duk_type_error(ctx, "fs.unlink: Invalid path argument");
 
       // Normalize base path and input path
-      const std::filesystem::path basePath = std::filesystem::absolute(CACHE_DIR / "tempcontent");
+      const std::filesystem::path basePath = std::filesystem::absolute(ToolsInstall::getPackageDirectory());
       const std::filesystem::path fullPath = std::filesystem::absolute(basePath / path);
       // Check for path traversal
       if (fullPath.string().find(basePath.string()) != 0) {
@@ -141,7 +141,7 @@ struct customJS {
       if (!contents) return duk_type_error(ctx, "fs.write: Invalid contents argument");
 
       // Normalize base path and input path
-      const std::filesystem::path basePath = std::filesystem::absolute(CACHE_DIR / "tempcontent");
+      const std::filesystem::path basePath = std::filesystem::absolute(ToolsInstall::getPackageDirectory());
       const std::filesystem::path fullPath = std::filesystem::absolute(basePath / path);
       // Check for path traversal
       if (fullPath.string().find(basePath.string()) != 0) {
@@ -152,6 +152,9 @@ struct customJS {
         return duk_generic_error(ctx, "fs.write: Path already exists and is not a file");
       }
 
+      // Replace the file rather than writing into it, as it may be hard linked to the package cache
+      std::error_code error;
+      std::filesystem::remove(fullPath, error);
       std::ofstream fileStream(fullPath);
       fileStream << contents;
       fileStream.close();
@@ -167,7 +170,7 @@ struct customJS {
       if (!newPath) return duk_type_error(ctx, "fs.rename: Invalid newPath argument");
 
       // Normalize base path and input paths
-      const std::filesystem::path basePath = std::filesystem::absolute(CACHE_DIR / "tempcontent");
+      const std::filesystem::path basePath = std::filesystem::absolute(ToolsInstall::getPackageDirectory());
       const std::filesystem::path fullPathOld = std::filesystem::absolute(basePath / oldPath);
       const std::filesystem::path fullPathNew = std::filesystem::absolute(basePath / newPath);
       // Check for path traversal
@@ -336,8 +339,8 @@ struct customJS {
       if (!path) return duk_type_error(ctx, "download.file: Invalid path argument");
       if (!url) return duk_type_error(ctx, "download.file: Invalid URL argument");
 
-      const std::filesystem::path fullPath = CACHE_DIR / "tempcontent" / path;
-      if (std::filesystem::exists(path)) return duk_generic_error(ctx, "download.file: Path already occupied");
+      const std::filesystem::path fullPath = ToolsInstall::getPackageDirectory() / path;
+      if (std::filesystem::exists(fullPath)) return duk_generic_error(ctx, "download.file: Path already occupied");
 
       if (!ToolsCURL::downloadFile(url, fullPath)) {
         return duk_generic_error(ctx, "download.file: Download failed");
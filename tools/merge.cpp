@@ -1,5 +1,6 @@
 #include <QCoreApplication>
 #include <QDir>
+#include <QDirIterator>
 #include <QFile>
 #include <QMap>
 #include <QSet>
@@ -7,6 +8,7 @@
 #include <QTextStream>
 
 #include "../globals.h"
+#include "progress.h" // ToolsProgress
 
 // Definitions for this source file
 #include "merge.h"
@@ -351,6 +353,7 @@ void mergeSource (const QString &src, const QString &dest, sourceProperties &pro
 
     // If not a file, no clue what this, skip it
     if (!entry.isFile()) continue;
+    ToolsProgress::add(ToolsProgress::STAGE_MERGE, 1, entry.size());
 
     // Handle files based on file type
     QString suffix = entry.suffix();
@@ -370,6 +373,18 @@ void mergeSource (const QString &src, const QString &dest, sourceProperties &pro
 
 // Merges a list of package source directories into the destination directory
 void ToolsMerge::mergeSourcesList (QStringList &sources, QString &destination) {
+
+  // Count the files up front, so that progress can be reported as a fraction
+  for (const QString &sourceDir : sources) {
+    QDirIterator iterator(sourceDir, QDir::Files, QDirIterator::Subdirectories);
+    uint64_t files = 0;
+    while (iterator.hasNext()) {
+      iterator.next();
+      files ++;
+    }
+    ToolsProgress::expect(ToolsProgress::STAGE_MERGE, files, 0);
+  }
+
   int index = 1;
   for (const QString &sourceDir : sources) {
     sourceProperties properties = sourceProperties(index, sourceDir);
@@ -379,4 +394,5 @@ void ToolsMerge::mergeSourcesList (QStringList &sources, QString &destination) {
     QDir(sourceDir).removeRecursively();
     replaceScriptGlobals(properties);
   }
+
 }
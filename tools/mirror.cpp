@@ -0,0 +1,242 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <ctime>
+
+#include "../globals.h" // Project globals
+#include "curl.h" // ToolsCURL
+
+// Definitions for this source file
+#include "mirror.h"
+
+// Weight of a new measurement against those before it
+#define MIRROR_SMOOTHING 0.3
+// Seconds after which a host's latency is measured again before ranking it
+#define MIRROR_PROBE_INTERVAL (6 * 60 * 60)
+// Seconds to wait for a host to answer a probe
+#define MIRROR_PROBE_TIMEOUT 5
+// Seconds after which a host's failures are forgiven
+#define MIRROR_FAILURE_MEMORY (60 * 60)
+// Transfer size used to weigh latency against throughput when comparing hosts
+#define MIRROR_REFERENCE_SIZE (32 << 20)
+// Transfers smaller than this mostly measure latency, so they don't count towards throughput
+#define MIRROR_MIN_SAMPLE_SIZE (256 << 10)
+
+// What's known about a host from the transfers made to it, across sessions
+struct hostStats {
+  // Seconds until the first byte of a response arrives, and bytes per second after that (-1 if unknown)
+  double latency = -1;
+  double throughput = -1;
+  // Failures in a row, and when the last one happened
+  int failures = 0;
+  time_t lastFailure = 0;
+  // When the latency was last measured
+  time_t measured = 0;
+};
+
+// Statistics of every host seen so far, keyed by origin, loaded from disk on first use
+// Changes are only marked as unsaved, and get written out once a probe or download is done, see ToolsMirror::saveStats
+std::unordered_map<std::string, hostStats> hosts;
+std::mutex hostsMutex;
+bool hostsLoaded = false;
+bool hostsChanged = false;
+
+// Returns the path of the file which keeps host statistics between sessions
+std::filesystem::path getMirrorStatsPath () {
+  return CACHE_DIR / "mirrors.txt";
+}
+
+// Reduces a URL to its scheme, host and port
+std::string getOrigin (const std::string &url) {
+  const size_t schemeEnd = url.find("://");
+  if (schemeEnd == std::string::npos) return url;
+  return url.substr(0, url.find('/', schemeEnd + 3));
+}
+
+// Reads the host statistics of earlier sessions, expects hostsMutex to be held
+void loadHostStats () {
+
+  if (hostsLoaded) return;
+  hostsLoaded = true;
+
+  std::ifstream file(getMirrorStatsPath());
+  if (!file.is_open()) return;
+
+  // Each line holds the origin followed by the fields of hostStats in order
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream fields(line);
+    std::string origin;
+    hostStats stats;
+    if (fields >> origin >> stats.latency >> stats.throughput >> stats.failures >> stats.lastFailure >> stats.measured) {
+      hosts[origin] = stats;
+    }
+  }
+
+}
+
+// Writes the host statistics to disk, expects hostsMutex to be held
+void saveHostStats () {
+
+  if (!CACHE_ENABLE) return;
+
+  const std::filesystem::path path = getMirrorStatsPath();
+  const std::filesystem::path tempPath = path.string() + ".tmp";
+
+  std::ofstream file(tempPath);
+  if (!file.is_open()) {
+    LOGFILE << "[W] Failed to open " << tempPath << " for writing." << std::endl;
+    return;
+  }
+  for (const auto &host : hosts) {
+    const hostStats &stats = host.second;
+    file << host.first << ' ' << stats.latency << ' ' << stats.throughput << ' ' << stats.failures << ' '
+      << stats.lastFailure << ' ' << stats.measured << '\n';
+  }
+  file.close();
+
+  // Replace the old copy only once the new one is complete
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+
+}
+
+// Blends a new measurement into a running average, which starts out unknown (below 0)
+void smoothValue (double &average, double sample) {
+  average = average < 0 ? sample : average + (sample - average) * MIRROR_SMOOTHING;
+}
+
+// Returns the estimated number of seconds it'd take to fetch a file of the reference size from a host
+// Hosts of unknown throughput are assumed to be as fast as the given fallback (if above 0)
+double estimateFetchTime (const hostStats &stats, double fallbackThroughput, time_t now) {
+
+  // A host that didn't answer the last probe is assumed to take as long as the probe waited
+  double time = stats.latency < 0 ? MIRROR_PROBE_TIMEOUT : stats.latency;
+  const double throughput = stats.throughput > 0 ? stats.throughput : fallbackThroughput;
+  if (throughput > 0) time += MIRROR_REFERENCE_SIZE / throughput;
+
+  // Recent failures make a host less appealing with each one
+  if (now - stats.lastFailure < MIRROR_FAILURE_MEMORY) time *= 1 + stats.failures;
+
+  return time;
+
+}
+
+// Measures the latency of every host among the given URLs which hasn't been measured recently
+// Blocks for up to a few seconds, so this is meant to run in the background once an index has loaded
+void ToolsMirror::probeHosts (const std::vector<std::string> &urls) {
+
+  const time_t now = std::time(nullptr);
+
+  // Pick one URL per host with no recent latency measurement
+  std::vector<std::string> unmeasured;
+  {
+    std::lock_guard<std::mutex> lock(hostsMutex);
+    loadHostStats();
+    for (const std::string &url : urls) {
+      hostStats &stats = hosts[getOrigin(url)];
+      if (now - stats.measured <= MIRROR_PROBE_INTERVAL) continue;
+      // Stamp the host right away, so that other repositories loading alongside don't probe it again
+      stats.measured = now;
+      unmeasured.push_back(url);
+    }
+  }
+  if (unmeasured.empty()) return;
+
+  // Measure them all at once
+  const std::vector<double> latencies = ToolsCURL::probeLatency(unmeasured, MIRROR_PROBE_TIMEOUT);
+  for (size_t i = 0; i < unmeasured.size(); i ++) {
+    if (latencies[i] < 0) ToolsMirror::recordFailure(unmeasured[i]);
+    else ToolsMirror::recordTransfer(unmeasured[i], latencies[i], 0, 0);
+  }
+
+  ToolsMirror::saveStats();
+  LOGFILE << "[I] Probed " << unmeasured.size() << " mirror hosts" << std::endl;
+
+}
+
+// Returns the given package file URL and its mirrors, fastest first
+// Only what's already known is used, so this never waits on the network. Hosts that haven't
+// been probed yet keep the order the repository listed them in, and a stall fails over anyway
+std::vector<std::string> ToolsMirror::rankSources (const std::string &url, const std::vector<std::string> &mirrors) {
+
+  std::vector<std::string> sources = { url };
+  for (const std::string &mirror : mirrors) {
+    if (std::find(sources.begin(), sources.end(), mirror) == sources.end()) sources.push_back(mirror);
+  }
+  if (sources.size() < 2) return sources;
+
+  const time_t now = std::time(nullptr);
+
+  std::lock_guard<std::mutex> lock(hostsMutex);
+  loadHostStats();
+
+  // Hosts of unknown throughput are compared as if they were average
+  double throughputSum = 0;
+  int throughputCount = 0;
+  for (const std::string &source : sources) {
+    const hostStats &stats = hosts[getOrigin(source)];
+    if (stats.throughput <= 0) continue;
+    throughputSum += stats.throughput;
+    throughputCount ++;
+  }
+  const double averageThroughput = throughputCount > 0 ? throughputSum / throughputCount : 0;
+
+  // Ties go to whichever source the repository listed first
+  std::stable_sort(sources.begin(), sources.end(), [averageThroughput, now](const std::string &a, const std::string &b) {
+    return estimateFetchTime(hosts[getOrigin(a)], averageThroughput, now) < estimateFetchTime(hosts[getOrigin(b)], averageThroughput, now);
+  });
+
+  LOGFILE << "[I] Picked \"" << sources[0] << "\" out of " << sources.size() << " sources" << std::endl;
+  return sources;
+
+}
+
+// Records a successful request to the given URL's host: how long the response took to start,
+// and how many bytes then arrived in how many seconds (0 if only the latency was measured)
+void ToolsMirror::recordTransfer (const std::string &url, double latency, uint64_t bytes, double seconds) {
+
+  std::lock_guard<std::mutex> lock(hostsMutex);
+  loadHostStats();
+
+  hostStats &stats = hosts[getOrigin(url)];
+  smoothValue(stats.latency, latency);
+  stats.measured = std::time(nullptr);
+  stats.failures = 0;
+  if (bytes >= MIRROR_MIN_SAMPLE_SIZE && seconds > 0) smoothValue(stats.throughput, bytes / seconds);
+
+  hostsChanged = true;
+
+}
+
+// Records a failed or stalled request to the given URL's host
+void ToolsMirror::recordFailure (const std::string &url) {
+
+  std::lock_guard<std::mutex> lock(hostsMutex);
+  loadHostStats();
+
+  hostStats &stats = hosts[getOrigin(url)];
+  stats.failures ++;
+  stats.lastFailure = std::time(nullptr);
+  // Don't hold up every download by probing a host that's down
+  stats.measured = stats.lastFailure;
+
+  hostsChanged = true;
+
+}
+
+// Writes the host statistics to disk if anything has been recorded since they were last written
+void ToolsMirror::saveStats () {
+
+  std::lock_guard<std::mutex> lock(hostsMutex);
+  if (!hostsChanged) return;
+  hostsChanged = false;
+
+  saveHostStats();
+
+}
@@ -0,0 +1,17 @@
+#ifndef TOOLS_MIRROR_H
+#define TOOLS_MIRROR_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class ToolsMirror {
+  public:
+    static void probeHosts (const std::vector<std::string> &urls);
+    static std::vector<std::string> rankSources (const std::string &url, const std::vector<std::string> &mirrors);
+    static void recordTransfer (const std::string &url, double latency, uint64_t bytes, double seconds);
+    static void recordFailure (const std::string &url);
+    static void saveStats ();
+};
+
+#endif
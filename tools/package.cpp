@@ -14,6 +14,7 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QJsonValue>
+#include <QEvent>
 
 #include "../ui/packageitem.h"
 #include "../ui/packageinfo.h"
@@ -22,10 +23,14 @@
 #include "curl.h" // ToolsCURL
 #include "qt.h" // ToolsQT
 #include "install.h" // ToolsInstall
+#include "progress.h" // ToolsProgress
 
 // Definitions for this source file
 #include "package.h"
 
+// Holds a list of packages to be used for merging
+std::vector<const ToolsPackage::PackageData*> SPPLICE_MERGE_SOURCES;
+
 // Constructs the PackageData instance from a JSON object
 ToolsPackage::PackageData::PackageData (QJsonObject package, const std::string &repoURL) {
 
@@ -60,6 +65,27 @@ ToolsPackage::PackageData::PackageData (QJsonObject package, const std::string &
     }
   }
 
+  // Repositories may list other hosts serving the same file, which get used if they're faster or the main one fails
+  if (package.contains("mirrors")) {
+    QJsonArray mirrors = package["mirrors"].toArray();
+    for (const QJsonValue &mirror : mirrors) {
+      this->mirrors.push_back(mirror.toString().toStdString());
+    }
+  }
+
+  // Patches can only be applied if the result can be checked against the file's checksum
+  this->crc64 = package["crc64"].toString().toStdString();
+  if (package.contains("patches") && !this->crc64.empty()) {
+    QJsonArray patches = package["patches"].toArray();
+    for (const QJsonValue &patch : patches) {
+      QJsonObject patchObject = patch.toObject();
+      this->patches.push_back({ patchObject["from"].toString().toStdString(), patchObject["file"].toString().toStdString() });
+    }
+  }
+
+  // Packages which rely on their copies of base game files being present can opt out of skipping them
+  this->skipBaseFiles = package["skip_base_files"].toBool(true);
+
 }
 
 void PackageItemWorker::getPackageIcon (const ToolsPackage::PackageData *package, const QSize iconSize) {
@@ -81,7 +107,7 @@ void PackageItemWorker::getPackageIcon (const ToolsPackage::PackageData *package
       ToolsInstall::updateFileVersion(imagePath, package->version);
       // Attempt the download 5 times before giving up
       for (int attempts = 0; attempts < 5; attempts ++) {
-        if (ToolsCURL::downloadFile(package->icon, imagePath)) break;
+        if (ToolsCURL::downloadFile(package->icon, imagePath, ToolsCURL::PRIORITY_ICON)) break;
       }
     }
   }
@@ -96,6 +122,23 @@ void PackageItemWorker::getPackageIcon (const ToolsPackage::PackageData *package
 
 };
 
+// Time the pointer has to rest on an install button before the package gets prefetched
+#define PREFETCH_HOVER_DELAY 300
+
+PackageHoverFilter::PackageHoverFilter (const ToolsPackage::PackageData *package, QObject *parent) : QObject(parent) {
+  dwellTimer.setSingleShot(true);
+  dwellTimer.setInterval(PREFETCH_HOVER_DELAY);
+  QObject::connect(&dwellTimer, &QTimer::timeout, [package]() {
+    ToolsInstall::prefetchPackage(package);
+  });
+}
+
+bool PackageHoverFilter::eventFilter (QObject *watched, QEvent *event) {
+  if (event->type() == QEvent::Enter) dwellTimer.start();
+  else if (event->type() == QEvent::Leave) dwellTimer.stop();
+  return false;
+}
+
 void PackageItemWorker::installPackage (const ToolsPackage::PackageData *package) {
 
   // If a package is already installing (or installed), exit early
@@ -107,20 +150,40 @@ void PackageItemWorker::installPackage (const ToolsPackage::PackageData *package
   SPPLICE_INSTALL_STATE = 1;
   emit installStateUpdate();
 
-  // Download the package archive
-  const std::filesystem::path filePath = ToolsInstall::downloadPackageFromData(package);
-  // Handle download errors
-  if (filePath.empty()) {
-    if (package->repository == "local") ToolsQT::displayErrorPopup("Installation aborted", "Package file missing.");
-    else ToolsQT::displayErrorPopup("Installation aborted", "Failed to download package file.");
-    emit installWorkerDone();
-    return;
+  // Pick up a prefetch of this package before checking what's in the cache
+  ToolsInstall::claimPrefetch(package);
+
+  // Report each stage of the install on the button, the worker's signals get queued to the UI thread
+  ToolsProgress::begin(package->title, [this](const ToolsProgress::Update &update) {
+    emit installProgressUpdate(QString::fromStdString(ToolsProgress::describe(update)));
+  });
+
+  std::string installationResult;
+
+  if (STREAM_ENABLE && package->repository != "local" && !ToolsInstall::isPackageCached(package)) {
+    // Extract the package archive while it downloads
+    installationResult = ToolsInstall::installPackageStream(package);
+  } else {
+    // Download the package archive
+    const std::filesystem::path filePath = ToolsInstall::downloadPackageFromData(package);
+    // Handle download errors
+    if (filePath.empty()) {
+      if (package->repository == "local") ToolsQT::displayErrorPopup("Installation aborted", "Package file missing.");
+      else ToolsQT::displayErrorPopup("Installation aborted", "Failed to download package file.");
+      ToolsProgress::end();
+      SPPLICE_INSTALL_STATE = 0;
+      emit installStateUpdate();
+      emit installWorkerDone();
+      return;
+    }
+    // Attempt installation
+    installationResult = ToolsInstall::installPackageFile(filePath, package->args, package->version, package->skipBaseFiles);
+
+    // Remove downloaded archive post-installation if caching is disabled
+    if (!CACHE_ENABLE && package->repository != "local") std::filesystem::remove(filePath);
   }
-  // Attempt installation
-  std::string installationResult = ToolsInstall::installPackageFile(filePath, package->args);
 
-  // Remove downloaded archive post-installation if caching is disabled
-  if (!CACHE_ENABLE && package->repository != "local") std::filesystem::remove(filePath);
+  ToolsProgress::end();
 
   // If installation failed, display error and exit early
   if (installationResult != "") {
@@ -166,6 +229,7 @@ QWidget* ToolsPackage::createPackageItem (const ToolsPackage::PackageData *packa
 
   // Connect the install button
   QPushButton *installButton = itemUI.PackageInstallButton;
+  installButton->installEventFilter(new PackageHoverFilter(package, installButton));
   QObject::connect(installButton, &QPushButton::clicked, [installButton, package]() {
 
     // If package merging is enabled, this button just adds the package to a list
@@ -177,6 +241,8 @@ QWidget* ToolsPackage::createPackageItem (const ToolsPackage::PackageData *packa
         SPPLICE_MERGE_SOURCES.push_back(package);
         installButton->setText("Selected");
         installButton->setStyleSheet("color: #faa81a;");
+        // Selected packages are likely to be merged soon
+        ToolsInstall::prefetchPackage(package);
         return;
       }
       // If it was found, remove it
@@ -214,6 +280,11 @@ QWidget* ToolsPackage::createPackageItem (const ToolsPackage::PackageData *packa
       }
     });
 
+    // Show the progress of each stage while installing
+    QObject::connect(worker, &PackageItemWorker::installProgressUpdate, installButton, [installButton](QString text) {
+      if (SPPLICE_INSTALL_STATE == 1) installButton->setText(text);
+    });
+
     // Clean up the thread once it's done
     QObject::connect(worker, &PackageItemWorker::installWorkerDone, workerThread, &QThread::quit);
     QObject::connect(worker, &PackageItemWorker::installWorkerDone, worker, &PackageItemWorker::deleteLater);
@@ -247,6 +318,9 @@ QWidget* ToolsPackage::createPackageItem (const ToolsPackage::PackageData *packa
   // Connect the "Read more" button
   QObject::connect(itemUI.PackageInfoButton, &QPushButton::clicked, [package]() {
 
+    // Reading up on a package is a good sign it's about to be installed
+    ToolsInstall::prefetchPackage(package);
+
     QDialog *dialog = new QDialog;
     Ui::PackageInfo dialogUI;
     dialogUI.setupUi(dialog);
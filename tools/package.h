@@ -5,10 +5,17 @@
 #include <QObject>
 #include <QPixmap>
 #include <QJsonObject>
+#include <QTimer>
 
 class ToolsPackage {
   public:
 
+    // A binary patch which turns an older version of a package's file into the current one
+    struct PatchData {
+      std::string from;
+      std::string file;
+    };
+
     // The structure of a package's properties
     struct PackageData {
 
@@ -18,8 +25,14 @@ class ToolsPackage {
       std::string version;
       std::vector<std::string> args;
       std::string file;
+      // Alternative URLs serving the same file
+      std::vector<std::string> mirrors;
+      // CRC64 of the file in hexadecimal (empty if not given), and patches from older versions to it
+      std::string crc64;
+      std::vector<PatchData> patches;
       std::string icon;
       std::string repository;
+      bool skipBaseFiles;
 
       PackageData (QJsonObject package, const std::string &url);
 
@@ -29,6 +42,20 @@ class ToolsPackage {
 
 };
 
+// Holds a list of packages to be used for merging
+// Kept here rather than in globals.h, which stays free of Qt for tools that don't link it
+extern std::vector<const ToolsPackage::PackageData*> SPPLICE_MERGE_SOURCES;
+
+// Prefetches a package once the pointer has rested on its install button for a moment
+class PackageHoverFilter : public QObject {
+  public:
+    PackageHoverFilter (const ToolsPackage::PackageData *package, QObject *parent);
+    bool eventFilter (QObject *watched, QEvent *event) override;
+
+  private:
+    QTimer dwellTimer;
+};
+
 class PackageItemWorker : public QObject {
   Q_OBJECT
 
@@ -40,6 +67,7 @@ class PackageItemWorker : public QObject {
     void packageIconResult (QPixmap pixmap);
     void packageIconReady ();
     void installStateUpdate ();
+    void installProgressUpdate (QString text);
     void installWorkerDone ();
 
 };
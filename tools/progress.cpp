@@ -0,0 +1,208 @@
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <mutex>
+#include <chrono>
+
+#include "../globals.h" // Project globals
+
+// Definitions for this source file
+#include "progress.h"
+
+// Minimum time between updates handed to the listener, and between progress lines in the log
+#define PROGRESS_LISTENER_INTERVAL std::chrono::milliseconds(250)
+#define PROGRESS_LOG_INTERVAL std::chrono::seconds(2)
+// Time after its last report at which a stage is considered to be waiting on another one
+#define PROGRESS_STAGE_IDLE std::chrono::seconds(1)
+
+// Everything known about a single stage of the current install
+struct progressStage {
+  ToolsProgress::Update update;
+  bool started = false;
+  std::chrono::steady_clock::time_point firstReport;
+  std::chrono::steady_clock::time_point lastReport;
+  // Byte count and time at which the rate was last measured
+  uint64_t rateBytes = 0;
+  std::chrono::steady_clock::time_point rateTime;
+};
+
+// State of the install in progress, reports outside of one are ignored
+std::mutex progressMutex;
+bool progressActive = false;
+std::string progressName;
+std::function<void (const ToolsProgress::Update &update)> progressListener;
+std::chrono::steady_clock::time_point progressStart;
+std::chrono::steady_clock::time_point progressLastListener;
+std::chrono::steady_clock::time_point progressLastLog;
+progressStage progressStages[ToolsProgress::STAGE_COUNT];
+
+const char *stageNames[ToolsProgress::STAGE_COUNT] = { "Download", "Extraction", "Merge" };
+
+// Formats a byte count in MiB with one decimal
+std::string formatMiB (double bytes) {
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(1) << bytes / (1 << 20) << " MiB";
+  return output.str();
+}
+
+// Returns the number of seconds between two points in time
+double secondsBetween (std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+  return std::chrono::duration<double>(to - from).count();
+}
+
+// Writes a line describing the given stage to the log
+void logStage (const progressStage &stage) {
+
+  const ToolsProgress::Update &update = stage.update;
+  LOGFILE << "[I] " << stageNames[update.stage] << ": " << update.items;
+  if (update.totalItems) LOGFILE << " of " << update.totalItems;
+  LOGFILE << (update.stage == ToolsProgress::STAGE_DOWNLOAD ? " transfers" : " files");
+  if (update.bytes) {
+    LOGFILE << ", " << formatMiB(update.bytes);
+    if (update.totalBytes) LOGFILE << " of " << formatMiB(update.totalBytes);
+    LOGFILE << " at " << formatMiB(update.rate) << "/s";
+  }
+  LOGFILE << std::endl;
+
+}
+
+// Starts tracking the progress of an install, passing throttled updates to the listener (if any)
+// The listener is called from whichever thread reports progress
+void ToolsProgress::begin (const std::string &name, std::function<void (const Update &update)> listener) {
+
+  std::lock_guard<std::mutex> lock(progressMutex);
+
+  progressActive = true;
+  progressName = name;
+  progressListener = listener;
+  progressStart = std::chrono::steady_clock::now();
+  progressLastListener = progressStart;
+  progressLastLog = progressStart;
+
+  for (int i = 0; i < STAGE_COUNT; i ++) {
+    progressStages[i] = progressStage();
+    progressStages[i].update.stage = (Stage)i;
+  }
+
+  LOGFILE << "[I] Started installing \"" << name << '"' << std::endl;
+
+}
+
+// Counts items and bytes towards the given stage, reporting progress if enough time has passed since the last report
+// Safe to call from any thread, with the amounts processed since the previous call
+void ToolsProgress::add (Stage stage, uint64_t items, uint64_t bytes) {
+
+  std::lock_guard<std::mutex> lock(progressMutex);
+  if (!progressActive) return;
+
+  const auto now = std::chrono::steady_clock::now();
+  progressStage &current = progressStages[stage];
+
+  if (!current.started) {
+    current.started = true;
+    current.firstReport = now;
+    current.rateTime = now;
+    LOGFILE << "[I] " << stageNames[stage] << " started " << std::fixed << std::setprecision(2)
+      << secondsBetween(progressStart, now) << "s into the install" << std::defaultfloat << std::endl;
+  }
+  current.lastReport = now;
+  current.update.items += items;
+  current.update.bytes += bytes;
+
+  if (now - progressLastListener < PROGRESS_LISTENER_INTERVAL) return;
+  progressLastListener = now;
+
+  // Smooth the rates over recent intervals, so that they don't jump around with every packet
+  for (progressStage &stage : progressStages) {
+    const double elapsed = secondsBetween(stage.rateTime, now);
+    if (!stage.started || elapsed <= 0) continue;
+    const double rate = (stage.update.bytes - stage.rateBytes) / elapsed;
+    stage.update.rate = stage.update.rate == 0 ? rate : stage.update.rate * 0.5 + rate * 0.5;
+    stage.rateBytes = stage.update.bytes;
+    stage.rateTime = now;
+  }
+
+  // Stages can overlap, as when extracting an archive while it streams in, so report the one holding up the rest:
+  // the earliest that's still going, as every later stage is fed by it. One that's blocked on a later stage stops
+  // reporting, which hands over to that one
+  const progressStage *shown = &current;
+  for (const progressStage &stage : progressStages) {
+    if (!stage.started || now - stage.lastReport > PROGRESS_STAGE_IDLE) continue;
+    if (stage.update.totalBytes && stage.update.bytes >= stage.update.totalBytes) continue;
+    shown = &stage;
+    break;
+  }
+
+  if (progressListener) progressListener(shown->update);
+
+  if (now - progressLastLog < PROGRESS_LOG_INTERVAL) return;
+  progressLastLog = now;
+  logStage(*shown);
+
+}
+
+// Adds to the number of items and bytes the given stage is expected to process in total
+// The byte count may be negative, to correct an earlier estimate
+void ToolsProgress::expect (Stage stage, uint64_t items, int64_t bytes) {
+
+  std::lock_guard<std::mutex> lock(progressMutex);
+  if (!progressActive) return;
+
+  progressStages[stage].update.totalItems += items;
+  uint64_t &totalBytes = progressStages[stage].update.totalBytes;
+  totalBytes = bytes < 0 && (uint64_t)-bytes > totalBytes ? 0 : totalBytes + bytes;
+
+}
+
+// Stops tracking the current install, logging how long each stage took
+void ToolsProgress::end () {
+
+  std::lock_guard<std::mutex> lock(progressMutex);
+  if (!progressActive) return;
+
+  const auto now = std::chrono::steady_clock::now();
+  LOGFILE << "[I] Finished installing \"" << progressName << "\" in " << std::fixed << std::setprecision(2)
+    << secondsBetween(progressStart, now) << "s" << std::defaultfloat << std::endl;
+
+  for (progressStage &stage : progressStages) {
+    if (!stage.started) continue;
+    const double duration = secondsBetween(stage.firstReport, stage.lastReport);
+    if (duration > 0) stage.update.rate = stage.update.bytes / duration;
+    logStage(stage);
+    LOGFILE << "[I] " << stageNames[stage.update.stage] << " took " << std::fixed << std::setprecision(2)
+      << duration << "s" << std::defaultfloat << std::endl;
+  }
+
+  progressActive = false;
+  progressListener = nullptr;
+
+}
+
+// Returns a short description of the given update, fit for a button label
+std::string ToolsProgress::describe (const Update &update) {
+
+  std::ostringstream output;
+
+  switch (update.stage) {
+    case STAGE_DOWNLOAD:
+      output << "Downloading ";
+      if (update.totalBytes) output << std::min<uint64_t>(100, update.bytes * 100 / update.totalBytes) << "%";
+      else output << (update.bytes >> 20) << " MiB";
+      break;
+    case STAGE_EXTRACT:
+      output << "Extracting " << update.items;
+      break;
+    case STAGE_MERGE:
+      output << "Merging ";
+      if (update.totalItems) output << std::min<uint64_t>(100, update.items * 100 / update.totalItems) << "%";
+      else output << update.items;
+      break;
+    default:
+      output << "Installing...";
+      break;
+  }
+
+  return output.str();
+
+}
@@ -0,0 +1,33 @@
+#ifndef TOOLS_PROGRESS_H
+#define TOOLS_PROGRESS_H
+
+#include <string>
+#include <functional>
+#include <cstdint>
+
+class ToolsProgress {
+  public:
+
+    // Stages of an install, in the order they usually happen
+    enum Stage { STAGE_DOWNLOAD, STAGE_EXTRACT, STAGE_MERGE, STAGE_COUNT };
+
+    // Progress of a single stage
+    struct Update {
+      Stage stage;
+      // Files or archive entries processed so far, and how many are expected (0 if unknown)
+      uint64_t items = 0;
+      uint64_t totalItems = 0;
+      // Bytes processed so far, how many are expected (0 if unknown), and the recent rate in bytes per second
+      uint64_t bytes = 0;
+      uint64_t totalBytes = 0;
+      double rate = 0;
+    };
+
+    static void begin (const std::string &name, std::function<void (const Update &update)> listener = nullptr);
+    static void add (Stage stage, uint64_t items, uint64_t bytes);
+    static void expect (Stage stage, uint64_t items, int64_t bytes);
+    static void end ();
+    static std::string describe (const Update &update);
+};
+
+#endif
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <filesystem>
 #include <vector>
 #include <string>
@@ -39,9 +40,116 @@ std::vector<const ToolsPackage::PackageData*> ToolsRepo::parseRepository (const
 
 }
 
+// Returns the path at which the index of the given repository is cached
+std::filesystem::path getIndexCachePath (const std::string &url) {
+  // Generate a hash from the repository's URL to use as a file name
+  size_t urlHash = std::hash<std::string>{}(url);
+  return CACHE_DIR / "repositories" / std::to_string(urlHash);
+}
+
+// Reads the cached index of the given repository along with its ETag and Last-Modified values, returns false if there is none
+bool readCachedIndex (const std::string &url, std::string &json, std::string &etag, std::string &lastModified) {
+
+  std::ifstream file(getIndexCachePath(url), std::ios::binary);
+  if (!file.is_open() || !std::getline(file, etag) || !std::getline(file, lastModified)) return false;
+
+  // The rest of the file is the index itself
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  json = buffer.str();
+
+  return !json.empty();
+
+}
+
+// Writes the index of the given repository to the cache, preceded by its ETag and Last-Modified values
+void writeCachedIndex (const std::string &url, const std::string &json, const std::string &etag, const std::string &lastModified) {
+
+  const std::filesystem::path path = getIndexCachePath(url);
+  const std::filesystem::path tempPath = path.string() + ".tmp";
+
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+
+  std::ofstream file(tempPath, std::ios::binary);
+  if (!file.is_open()) {
+    LOGFILE << "[W] Failed to open " << tempPath << " for writing." << std::endl;
+    return;
+  }
+  file << etag << '\n' << lastModified << '\n' << json;
+  file.close();
+
+  // Replace the old copy only once the new one is complete
+  std::filesystem::rename(tempPath, path, error);
+  if (error) LOGFILE << "[W] Failed to cache repository index of \"" << url << "\": " << error.message() << std::endl;
+
+}
+
+// Icons get requested next, and package files on install, so connect to their hosts ahead of time
+void preconnectRepository (const std::vector<const ToolsPackage::PackageData*> &repository) {
+  for (const ToolsPackage::PackageData *package : repository) {
+    ToolsCURL::preconnect(package->icon);
+    ToolsCURL::preconnect(package->file);
+  }
+}
+
+// Parses the cached repository JSON of the given URL, returns an empty list if it isn't cached
+std::vector<const ToolsPackage::PackageData*> ToolsRepo::loadCachedRepository (const std::string &url) {
+
+  std::string json, etag, lastModified;
+  if (!CACHE_ENABLE || !readCachedIndex(url, json, etag, lastModified)) return {};
+
+  std::vector<const ToolsPackage::PackageData*> repository = ToolsRepo::parseRepository(json, url);
+  preconnectRepository(repository);
+
+  return repository;
+
+}
+
 // Fetches and parses repository JSON from the given URL
-std::vector<const ToolsPackage::PackageData*> ToolsRepo::fetchRepository (const std::string &url) {
-  return ToolsRepo::parseRepository(ToolsCURL::downloadString(url), url);
+// A cached index is revalidated instead, so the status tells an unchanged index apart from a failed
+// request, and both apart from a new index which may well list no packages at all
+ToolsRepo::FetchResult ToolsRepo::fetchRepository (const std::string &url) {
+
+  if (!CACHE_ENABLE) {
+    const std::string json = ToolsCURL::downloadString(url);
+    if (json.empty()) return { FETCH_FAILED, {} };
+    std::vector<const ToolsPackage::PackageData*> repository = ToolsRepo::parseRepository(json, url);
+    preconnectRepository(repository);
+    return { FETCH_UPDATED, repository };
+  }
+
+  std::string json, etag, lastModified;
+  const bool cached = readCachedIndex(url, json, etag, lastModified);
+  const std::string cachedJSON = json;
+
+  // Only download the index if it has changed since it was cached
+  const long status = ToolsCURL::revalidateString(url, json, etag, lastModified);
+  if (status == 304) {
+    LOGFILE << "[I] Repository index of \"" << url << "\" is up to date" << std::endl;
+    return { FETCH_UNCHANGED, {} };
+  }
+  if (status != 200) {
+    LOGFILE << "[W] Failed to fetch repository index of \"" << url << "\", status " << status << std::endl;
+    return { FETCH_FAILED, {} };
+  }
+
+  // Some servers don't support conditional requests, so compare the content too
+  if (cached && json == cachedJSON) {
+    writeCachedIndex(url, json, etag, lastModified);
+    return { FETCH_UNCHANGED, {} };
+  }
+
+  // An index without packages replaces the old one all the same, whether it's empty or malformed
+  std::vector<const ToolsPackage::PackageData*> repository = ToolsRepo::parseRepository(json, url);
+  if (repository.empty()) LOGFILE << "[W] Repository index of \"" << url << "\" lists no packages" << std::endl;
+  else LOGFILE << "[I] Repository index of \"" << url << "\" has changed, " << repository.size() << " packages" << std::endl;
+
+  writeCachedIndex(url, json, etag, lastModified);
+  preconnectRepository(repository);
+
+  return { FETCH_UPDATED, repository };
+
 }
 
 // Adds the given URL to the repository list file
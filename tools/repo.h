@@ -6,8 +6,16 @@
 
 class ToolsRepo {
   public:
+    // Whether a fetched index replaces the one displayed already
+    enum FetchStatus { FETCH_UPDATED, FETCH_UNCHANGED, FETCH_FAILED };
+    struct FetchResult {
+      FetchStatus status = FETCH_FAILED;
+      std::vector<const ToolsPackage::PackageData*> repository;
+    };
+
     static std::vector<const ToolsPackage::PackageData*> parseRepository (const std::string &json, const std::string &url = "local");
-    static std::vector<const ToolsPackage::PackageData*> fetchRepository (const std::string &url);
+    static std::vector<const ToolsPackage::PackageData*> loadCachedRepository (const std::string &url);
+    static FetchResult fetchRepository (const std::string &url);
     static void writeToFile (const std::string &url);
     static std::vector<std::string> readFromFile ();
     static void removeFromFile (const std::string &url);
@@ -0,0 +1,231 @@
+#include <iostream>
+#include <filesystem>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <QFile>
+#include <QString>
+#include <QCryptographicHash>
+
+#include "../globals.h" // Project globals
+
+// Definitions for this source file
+#include "store.h"
+
+// Returns the directory in which file contents are stored by their hash
+std::filesystem::path ToolsStore::getStorePath () {
+  return CACHE_DIR / "store";
+}
+
+// Returns the hex SHA-256 digest of the given file's contents, or an empty string on failure
+std::string ToolsStore::hashFile (const std::filesystem::path path) {
+
+#ifndef TARGET_WINDOWS
+  QFile file(QString::fromStdString(path.string()));
+#else
+  QFile file(QString::fromStdWString(path.wstring()));
+#endif
+  if (!file.open(QIODevice::ReadOnly)) return "";
+
+  QCryptographicHash hash(QCryptographicHash::Sha256);
+  if (!hash.addData(&file)) return "";
+
+  return hash.result().toHex().toStdString();
+
+}
+
+// Replaces a file with a hard link to its object in the store, adding it to the store if it's new
+// Returns the amount of bytes saved, or -1 if the file couldn't be linked
+intmax_t storeFile (const std::filesystem::path path, const std::filesystem::path storePath) {
+
+  const std::string hash = ToolsStore::hashFile(path);
+  if (hash.empty()) return -1;
+
+  std::error_code error;
+  const std::filesystem::path object = storePath / hash.substr(0, 2) / hash;
+  std::filesystem::create_directories(object.parent_path(), error);
+
+  // If this content hasn't been seen before, the file itself becomes the stored object
+  std::filesystem::create_hard_link(path, object, error);
+  if (!error) return 0;
+
+  // Otherwise, the object has to exist already, or the filesystem doesn't support hard links
+  if (!std::filesystem::exists(object, error)) return -1;
+  if (std::filesystem::equivalent(path, object, error)) return 0;
+
+  // Link to the existing object under a temporary name, then swap it in for the file
+  std::filesystem::path linkPath = path;
+  linkPath += ".spplice-link";
+  std::filesystem::create_hard_link(object, linkPath, error);
+  if (error) return -1;
+
+  const uintmax_t size = std::filesystem::file_size(path, error);
+  std::filesystem::rename(linkPath, path, error);
+  if (error) {
+    std::filesystem::remove(linkPath, error);
+    return -1;
+  }
+
+  return size;
+
+}
+
+// Deduplicates the files of an extracted tree against the store
+// Stops early, returning false, once the given function returns false
+bool ToolsStore::storeTree (const std::filesystem::path tree, std::function<bool ()> keepGoing) {
+
+  const auto start = std::chrono::steady_clock::now();
+  const std::filesystem::path storePath = ToolsStore::getStorePath();
+
+  // Collect the regular files first, so that they can be hashed in parallel
+  std::vector<std::filesystem::path> files;
+  try {
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(tree)) {
+      if (!entry.is_symlink() && entry.is_regular_file()) files.push_back(entry.path());
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    LOGFILE << "[E] Failed to list files of " << tree << ": " << e.what() << std::endl;
+    return false;
+  }
+
+  std::atomic<size_t> nextFile(0);
+  std::atomic<size_t> linkedFiles(0);
+  std::atomic<size_t> failedFiles(0);
+  std::atomic<uintmax_t> savedBytes(0);
+  std::atomic<bool> stopped(false);
+
+  auto storeLoop = [&]() {
+    for (size_t i = nextFile ++; i < files.size(); i = nextFile ++) {
+      if (stopped || !keepGoing()) {
+        stopped = true;
+        break;
+      }
+      const intmax_t saved = storeFile(files[i], storePath);
+      if (saved < 0) {
+        failedFiles ++;
+      } else if (saved > 0) {
+        linkedFiles ++;
+        savedBytes += saved;
+      }
+    }
+  };
+
+  const unsigned int threadCount = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < threadCount; i ++) threads.emplace_back(storeLoop);
+  storeLoop();
+  for (std::thread &thread : threads) thread.join();
+
+  // Whatever got stored so far stays that way, the rest is picked up next time
+  if (stopped) {
+    LOGFILE << "[I] Stopped storing files from " << tree << ", Spplice is busy" << std::endl;
+    return false;
+  }
+
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  LOGFILE << "[I] Stored " << files.size() << " files from " << tree << " in " << seconds << "s, "
+    << linkedFiles << " already stored (" << ToolsStore::formatSize(savedBytes) << " deduplicated)" << std::endl;
+
+  // Files which couldn't be linked stay in the tree as they are, so this isn't fatal
+  if (failedFiles > 0) {
+    LOGFILE << "[W] Failed to store " << failedFiles << " files, they won't be deduplicated" << std::endl;
+  }
+
+  return true;
+
+}
+
+// Removes stored objects which no extracted tree links to anymore
+void ToolsStore::pruneStore () {
+
+  const std::filesystem::path storePath = ToolsStore::getStorePath();
+  if (!std::filesystem::exists(storePath)) return;
+
+  size_t removedFiles = 0;
+  uintmax_t removedBytes = 0;
+
+  try {
+    std::error_code error;
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(storePath)) {
+      if (entry.is_symlink() || !entry.is_regular_file()) continue;
+      // The store's own link is the only one left
+      if (entry.hard_link_count(error) != 1) continue;
+      const uintmax_t size = entry.file_size(error);
+      if (std::filesystem::remove(entry.path(), error)) {
+        removedFiles ++;
+        removedBytes += size;
+      }
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    LOGFILE << "[W] Failed to prune the store: " << e.what() << std::endl;
+  }
+
+  if (removedFiles > 0) {
+    LOGFILE << "[I] Pruned " << removedFiles << " unused files (" << ToolsStore::formatSize(removedBytes) << ") from the store" << std::endl;
+  }
+
+}
+
+// Measures the cache, counting every file once as if it wasn't deduplicated, and once by what it takes up on disk
+ToolsStore::CacheUsage ToolsStore::getCacheUsage () {
+
+  CacheUsage usage;
+  const std::filesystem::path storePath = ToolsStore::getStorePath();
+
+  // The installed package's working copy isn't part of the cache
+  const std::filesystem::path tempPath = CACHE_DIR / "tempcontent";
+
+  try {
+    std::error_code error;
+    const auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto iterator = std::filesystem::recursive_directory_iterator(CACHE_DIR, options); iterator != std::filesystem::recursive_directory_iterator(); iterator ++) {
+      const std::filesystem::directory_entry &entry = *iterator;
+      if (entry.path() == tempPath) {
+        iterator.disable_recursion_pending();
+        continue;
+      }
+      if (entry.is_symlink() || !entry.is_regular_file()) continue;
+
+      const uintmax_t size = entry.file_size(error);
+      if (error) continue;
+
+      // Stored objects are what every hard link outside the store points to
+      if (entry.path().parent_path().parent_path() == storePath) {
+        usage.physical += size;
+        continue;
+      }
+
+      usage.logical += size;
+      if (entry.hard_link_count(error) == 1) usage.physical += size;
+    }
+  } catch (const std::filesystem::filesystem_error &e) {
+    LOGFILE << "[W] Failed to measure the cache: " << e.what() << std::endl;
+  }
+
+  return usage;
+
+}
+
+// Formats a byte count for display
+std::string ToolsStore::formatSize (uintmax_t bytes) {
+
+  const char *units[] = { "B", "KiB", "MiB", "GiB", "TiB" };
+  double size = bytes;
+  int unit = 0;
+
+  while (size >= 1024 && unit < 4) {
+    size /= 1024;
+    unit ++;
+  }
+
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << size << ' ' << units[unit];
+  return output.str();
+
+}
@@ -0,0 +1,26 @@
+#ifndef TOOLS_STORE_H
+#define TOOLS_STORE_H
+
+#include <filesystem>
+#include <string>
+#include <cstdint>
+#include <functional>
+
+class ToolsStore {
+  public:
+
+    // Disk usage of the cache, before and after accounting for deduplicated files
+    struct CacheUsage {
+      uintmax_t logical = 0;
+      uintmax_t physical = 0;
+    };
+
+    static std::filesystem::path getStorePath ();
+    static std::string hashFile (const std::filesystem::path path);
+    static bool storeTree (const std::filesystem::path tree, std::function<bool ()> keepGoing);
+    static void pruneStore ();
+    static CacheUsage getCacheUsage ();
+    static std::string formatSize (uintmax_t bytes);
+};
+
+#endif
@@ -85,7 +85,8 @@ void ToolsUpdate::installUpdate () {
   LOGFILE << "[I] Downloading update from \"" << url << '"' << std::endl;
 
   const std::filesystem::path updatePath = CACHE_DIR / "update_binary";
-  bool success = ToolsCURL::downloadFile(url, updatePath);
+  // Updates download in the background, making way for anything the user is waiting on
+  bool success = ToolsCURL::downloadFile(url, updatePath, ToolsCURL::PRIORITY_PREFETCH);
   // If the download failed, do nothing
   if (!success) {
     LOGFILE << "[E] Failed to download update from \"" << url << '"' << std::endl;
@@ -24,6 +24,7 @@
 #include "../globals.h" // Project globals
 #include "../tools/package.h" // ToolsPackage
 #include "../tools/install.h" // ToolsInstall
+#include "../tools/extract.h" // ToolsExtract
 
 MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent), ui(new Ui::MainWindow) {
   ui->setupUi(this);
@@ -49,7 +50,6 @@ void MainWindow::dropEvent (QDropEvent *event) {
 
   const std::filesystem::path archivePath = APP_DIR / "local";
   const std::filesystem::path indexPath = APP_DIR / "local.json";
-  const std::filesystem::path extractPath = CACHE_DIR / "extracted_package";
 
   // Ensure that the local repository archive file directory exists
   std::filesystem::create_directories(archivePath);
@@ -90,7 +90,6 @@ void MainWindow::dropEvent (QDropEvent *event) {
     packageArray = indexObject["packages"].toArray();
   } catch (const std::exception &e) {
     QMessageBox::critical(nullptr, "Package Error", "Failed to parse local package repository.");
-    std::filesystem::remove_all(extractPath);
     return;
   }
 
@@ -110,42 +109,17 @@ void MainWindow::dropEvent (QDropEvent *event) {
       LOGFILE << "[E] File is not a Spplice package." << std::endl;
     }
 
-    // Ensure a clean output directory for package extraction
-    if (std::filesystem::exists(extractPath)) {
-      std::filesystem::remove_all(extractPath);
-    }
-    std::filesystem::create_directories(extractPath);
-
-    // Extract the file like a standard tar.xz archive
-    if (!ToolsInstall::extractLocalFile(filePath, extractPath)) {
-      QMessageBox::critical(nullptr, "Package Error", "Failed to extract Spplice package file, it may be corrupted.\nTry downloading it again?");
-      std::filesystem::remove_all(extractPath);
-      continue;
-    }
-
-    // Find and open the package manifest JSON file
-    const std::filesystem::path manifestPath = extractPath / "manifest.json";
-    if (!std::filesystem::exists(manifestPath)) {
-      QMessageBox::critical(nullptr, "Package Error", "This Spplice package is missing a manifest file and can not be loaded.");
-      std::filesystem::remove_all(extractPath);
-      continue;
-    }
-    std::ifstream manifestFile(manifestPath);
-    if (!manifestFile.is_open()) {
-      QMessageBox::critical(nullptr, "Package Error", "Failed to open package manifest.");
-      std::filesystem::remove_all(extractPath);
+    // Read the package manifest straight out of the package file
+    std::string manifestString;
+    if (!ToolsExtract::readArchiveMember(filePath, "manifest.json", manifestString)) {
+      QMessageBox::critical(nullptr, "Package Error", "Failed to read the package manifest. The package may be missing one, or be corrupted.\nTry downloading it again?");
       continue;
     }
 
     try {
 
-      // Read the contents of the manifest file into a string
-      std::stringstream buffer;
-      buffer << manifestFile.rdbuf();
-      manifestFile.close();
-
       // Convert the string to a JSON document
-      QJsonDocument doc = QJsonDocument::fromJson(QString::fromStdString(buffer.str()).toUtf8());
+      QJsonDocument doc = QJsonDocument::fromJson(QString::fromStdString(manifestString).toUtf8());
       QJsonObject obj = doc.object();
 
       // Get system time to use as archive file name
@@ -156,31 +130,9 @@ void MainWindow::dropEvent (QDropEvent *event) {
       // Insert this into the package object as the "file" property
       obj.insert("file", QJsonValue(QString::fromStdString(timess.str())));
 
-      // Look for an extracted tar.xz archive and move it to its new location
-      try {
-        bool found = false;
-        for (const auto &entry : std::filesystem::directory_iterator(extractPath)) {
-          if (!entry.is_regular_file() || entry.path().extension() != ".xz") continue;
-          if (entry.path().stem().extension() != ".tar") continue;
-          found = true;
-
-          std::filesystem::rename(entry.path(), archivePath / timess.str());
-          break;
-        }
-        if (!found) {
-          QMessageBox::critical(nullptr, "Package Error", "No package archive found.");
-          std::filesystem::remove_all(extractPath);
-          continue;
-        }
-      } catch (const std::filesystem::filesystem_error &e) {
-        LOGFILE << "[E] Failed to process package archive: " << e.what() << std::endl;
-        QMessageBox::critical(nullptr, "Package Error", "Failed to process package archive.");
-        std::filesystem::remove_all(extractPath);
-        return;
-      }
-
       // Retrieve package icon string - this is either base64 or a filename
       const QString iconURL = obj["icon"].toString();
+      const bool iconIsFile = !iconURL.startsWith("data:image/");
 
       // Determine the image format from the MIME type
       const char *iconType = iconURL.startsWith("data:image/png") ? "PNG" : "JPEG";
@@ -194,7 +146,37 @@ void MainWindow::dropEvent (QDropEvent *event) {
       const QString iconDestinationQString = QString::fromStdWString(iconDestinationPath.wstring());
 #endif
 
-      if (iconURL.startsWith("data:image/")) {
+      // Copy the package archive (tar.xz or tar.zst) and icon file out of the package in one pass
+      const std::filesystem::path archiveDestinationPath = archivePath / timess.str();
+      const std::string iconMemberName = std::filesystem::path(iconURL.toStdString()).lexically_normal().generic_string();
+      bool archiveFound = false, iconFound = false;
+
+      int extracted = ToolsExtract::extractArchiveMembers(filePath, [&](const std::string &name, const std::string &magic) -> std::filesystem::path {
+        // Identify the archive by its contents, not its name
+        if (!archiveFound && name != iconMemberName && ToolsExtract::isPackageArchive(magic)) {
+          archiveFound = true;
+          return archiveDestinationPath;
+        }
+        if (iconIsFile && !iconFound && name == iconMemberName) {
+          iconFound = true;
+          return iconDestinationPath;
+        }
+        return std::filesystem::path();
+      }, iconIsFile ? 2 : 1);
+
+      if (extracted == -1) {
+        QMessageBox::critical(nullptr, "Package Error", "Failed to process package archive.");
+        std::filesystem::remove(archiveDestinationPath);
+        std::filesystem::remove(iconDestinationPath);
+        continue;
+      }
+      if (!archiveFound) {
+        QMessageBox::critical(nullptr, "Package Error", "No package archive found.");
+        std::filesystem::remove(iconDestinationPath);
+        continue;
+      }
+
+      if (!iconIsFile) {
         // If this looks like base64 data, use QImage to save it to file
         QImage icon;
         if (!icon.loadFromData(QByteArray::fromBase64(iconURL.split(",")[1].toLatin1()), iconType)) {
@@ -202,16 +184,8 @@ void MainWindow::dropEvent (QDropEvent *event) {
         } else if (!icon.save(iconDestinationQString, iconType)) {
           LOGFILE << "[W] Failed to write package icon to file." << std::endl;
         }
-      } else {
-        // If this looks like a file name, attempt to move it next to the archive
-        const std::filesystem::path iconSourcePath = archivePath / iconURL.toStdString();
-        if (!std::filesystem::exists(iconSourcePath)) {
-          LOGFILE << "[W] Package icon file specified in manifest does not exist." << std::endl;
-        } else try {
-          std::filesystem::rename(iconSourcePath, iconDestinationPath);
-        } catch (const std::filesystem::filesystem_error& e) {
-          LOGFILE << "[W] Failed to move extracted package icon file." << std::endl;
-        }
+      } else if (!iconFound) {
+        LOGFILE << "[W] Package icon file specified in manifest does not exist." << std::endl;
       }
       // Update the icon string
       obj.insert("icon", QJsonValue(QString::fromStdString(iconFileName)));
@@ -226,13 +200,9 @@ void MainWindow::dropEvent (QDropEvent *event) {
 
     } catch (const std::exception &e) {
       QMessageBox::critical(nullptr, "Package Error", "Failed to parse package manifest.");
-      std::filesystem::remove_all(extractPath);
       continue;
     }
 
-    // Clean up extracted files when done
-    std::filesystem::remove_all(extractPath);
-
   }
 
   // Insert the new package array into the repository index object